@@ -4,6 +4,7 @@
 // 一共8KB的以太网缓存
 static u8 ENC28J60BANK;
 int NextPacketPtr;
+static u8 ENC28J60RDPT;     // ERDPT 已指向 NextPacketPtr，读下一帧前不必重新设置
 
 
 //delay for ms unit
@@ -26,6 +27,7 @@ static inline void ENC28J60_cs_delayms(void)
 //Initialize SPI2 and related I/O for ENC28J60
 static void ENC28J60_SPI2_Init(void)
 {
+#if !defined(ENC28J60_EMULATOR)
     NVIC_InitTypeDef NVIC_InitStructure;
     EXTI_InitTypeDef EXTI_InitStructure;
     SPI_InitTypeDef  SPI_InitStructure;
@@ -88,6 +90,7 @@ static void ENC28J60_SPI2_Init(void)
     SPI_Cmd(SPI2, ENABLE); 
     
     SPI2_ReadWriteByte(0xff);
+#endif
 }
 
 void ENC28J60_Reset(void)
@@ -165,28 +168,35 @@ void ENC28J60_Write_Buf(u32 len,u8* data)
 }
 //Setup ENC28J60 register bank
 //ban: Bank to be setup
+//切到 bank 0 只需清位，从 bank 0 切出只需置位，其余情况才需要两条命令
 void ENC28J60_Set_Bank(u8 bank)
 {                                   
-    if((bank&BANK_MASK)!=ENC28J60BANK)
+    bank&=BANK_MASK;
+    if(bank!=ENC28J60BANK)
     {                 
-        ENC28J60_Write_Op(ENC28J60_BIT_FIELD_CLR,ECON1,(ECON1_BSEL1|ECON1_BSEL0));
-        ENC28J60_Write_Op(ENC28J60_BIT_FIELD_SET,ECON1,(bank&BANK_MASK)>>5);
-        ENC28J60BANK=(bank&BANK_MASK);
+        if(ENC28J60BANK!=0)ENC28J60_Write_Op(ENC28J60_BIT_FIELD_CLR,ECON1,(ECON1_BSEL1|ECON1_BSEL0));
+        if(bank!=0)ENC28J60_Write_Op(ENC28J60_BIT_FIELD_SET,ECON1,bank>>5);
+        ENC28J60BANK=bank;
     }
 }
+//公共寄存器（EIE~ECON1）在每个 bank 中都可访问，不需要切换
+static inline u8 ENC28J60_Is_Common(u8 addr)
+{
+    return (addr&ADDR_MASK)>=EIE;
+}
 //Read ENC28J60 register
 //addr: register address
 //return: read out value
 u8 ENC28J60_Read(u8 addr)
 {                         
-    ENC28J60_Set_Bank(addr);//select bank        
+    if(!ENC28J60_Is_Common(addr))ENC28J60_Set_Bank(addr);//select bank        
     return ENC28J60_Read_Op(ENC28J60_READ_CTRL_REG,addr);
 }
 //Write ENC28J60 register
 //addr: register address     
 void ENC28J60_Write(u8 addr,u8 data)
 {                     
-    ENC28J60_Set_Bank(addr);         
+    if(!ENC28J60_Is_Common(addr))ENC28J60_Set_Bank(addr);         
     ENC28J60_Write_Op(ENC28J60_WRITE_CTRL_REG,addr,data);
 }
 //Write into PHY register of ENC28J60
@@ -216,6 +226,7 @@ u8 ENC28J60_Init(u8* macaddr)
     if(retry>=500)return 1;//initialization failed
     //set Rx buffer address with 8k capacity
     NextPacketPtr=RXSTART_INIT;
+    ENC28J60RDPT=0;
 
     //初始化接收缓冲区，设置接收起始地址
     ENC28J60_Write(ERXSTL,RXSTART_INIT&0xFF);   
@@ -249,7 +260,8 @@ u8 ENC28J60_Init(u8* macaddr)
     // bring MAC out of reset
     ENC28J60_Write(MACON2,0x00);    //MACON2清零，让MAC退出复位状态
     // enable automatic padding to 60bytes and CRC operations
-    ENC28J60_Write_Op(ENC28J60_BIT_FIELD_SET,MACON3,MACON3_PADCFG0|MACON3_TXCRCEN|MACON3_FRMLNEN|MACON3_FULDPX);
+    // MACON3 是 MAC 寄存器，不支持 BFS，只能整体写入
+    ENC28J60_Write(MACON3,MACON3_PADCFG0|MACON3_TXCRCEN|MACON3_FRMLNEN|MACON3_FULDPX);
     // set inter-frame gap (non-back-to-back)
     ENC28J60_Write(MAIPGL,0x12);
     ENC28J60_Write(MAIPGH,0x0C);
@@ -313,5 +325,111 @@ u8 ENC28J60_Get_EREVID(void)
 {
     return ENC28J60_Read(EREVID);
 }
+//Send a packet
+//len: packet length
+//packet: packet pointer
+//控制字节与帧数据在同一次 WBM 命令中写入
+void ENC28J60_Packet_Send(u32 len,u8* packet)
+{
+    //上一帧还在发送则等待；发送出错时按 Rev. B errata 复位发送逻辑
+    while(ENC28J60_Read(ECON1)&ECON1_TXRTS)
+    {
+        if(ENC28J60_Read(EIR)&EIR_TXERIF)
+        {
+            ENC28J60_Write_Op(ENC28J60_BIT_FIELD_SET,ECON1,ECON1_TXRST);
+            ENC28J60_Write_Op(ENC28J60_BIT_FIELD_CLR,ECON1,ECON1_TXRST);
+        }
+    }
+    ENC28J60_Write(EWRPTL,TXSTART_INIT&0xFF);
+    ENC28J60_Write(EWRPTH,TXSTART_INIT>>8);
+    ENC28J60_Write(ETXNDL,(TXSTART_INIT+len)&0xFF);
+    ENC28J60_Write(ETXNDH,(TXSTART_INIT+len)>>8);
+
+    ENC28J60_SELECT();
+    ENC28J60_cs_delayms();
+    SPI2_ReadWriteByte(ENC28J60_WRITE_BUF_MEM);
+    SPI2_ReadWriteByte(0x00);   //per-packet control byte: 使用 MACON3 的设置
+    while(len--)
+    {
+        SPI2_ReadWriteByte(*packet++);
+    }
+    ENC28J60_cs_delayms();
+    ENC28J60_NO_SELECT();
+
+    ENC28J60_Write_Op(ENC28J60_BIT_FIELD_SET,ECON1,ECON1_TXRTS);
+}
+//Number of packets waiting in the Rx buffer
+u8 ENC28J60_Packet_Count(void)
+{
+    return ENC28J60_Read(EPKTCNT);
+}
+//Read the packet at NextPacketPtr and release its EPKTCNT slot
+//maxlen: max length of packet
+//packet: packet pointer
+//return: packet length, 0 if the packet is bad or longer than maxlen (it is skipped)
+//接收状态向量与帧数据在同一次 RBM 命令中读出，顺带读过 CRC 与填充字节，
+//使 ERDPT 正好停在下一帧，连续读取时不必再设置 ERDPT；ERXRDPT 由 ENC28J60_Packet_Free 一次释放
+u32 ENC28J60_Packet_Read(u32 maxlen,u8* packet)
+{
+    u8 header[6];
+    u32 len,skip,i;
+
+    if(!ENC28J60RDPT)
+    {
+        ENC28J60_Write(ERDPTL,NextPacketPtr&0xFF);
+        ENC28J60_Write(ERDPTH,NextPacketPtr>>8);
+    }
+
+    ENC28J60_SELECT();
+    ENC28J60_cs_delayms();
+    SPI2_ReadWriteByte(ENC28J60_READ_BUF_MEM);
+    for(i=0;i<6;i++)
+    {
+        header[i]=SPI2_ReadWriteByte(0);
+    }
+    NextPacketPtr=header[0]|(header[1]<<8);
+    len=(header[2]|(header[3]<<8))-4;  //去掉 CRC
+    //header[4] bit7: Received OK
+    if((header[4]&0x80)&&(len<=maxlen))
+    {
+        for(i=0;i<len;i++)
+        {
+            *packet++=SPI2_ReadWriteByte(0);
+        }
+        skip=4+(len&1);                 //CRC 与把下一帧对齐到偶地址的填充
+        while(skip--)SPI2_ReadWriteByte(0);
+        ENC28J60RDPT=1;
+    }
+    else
+    {
+        len=0;
+        ENC28J60RDPT=0;
+    }
+    ENC28J60_cs_delayms();
+    ENC28J60_NO_SELECT();
+
+    ENC28J60_Write_Op(ENC28J60_BIT_FIELD_SET,ECON2,ECON2_PKTDEC);
+    return len;
+}
+//Release the Rx buffer space of all packets read so far
+//Rev. B errata: ERXRDPT must be odd
+void ENC28J60_Packet_Free(void)
+{
+    u16 rdpt=(NextPacketPtr==RXSTART_INIT)?RXSTOP_INIT:(NextPacketPtr-1);
+    ENC28J60_Write(ERXRDPTL,rdpt&0xFF);
+    ENC28J60_Write(ERXRDPTH,rdpt>>8);
+}
+//Receive a packet
+//maxlen: max length of packet
+//packet: packet pointer
+//return: packet length, 0 if there is none
+u32 ENC28J60_Packet_Receive(u32 maxlen,u8* packet)
+{
+    u32 len;
+    if(ENC28J60_Packet_Count()==0)return 0;
+    len=ENC28J60_Packet_Read(maxlen,packet);
+    ENC28J60_Packet_Free();
+    return len;
+}
 
 
@@ -3,8 +3,12 @@
 #define _ENC28J60_H	
 
 //Include
+#if defined(ENC28J60_EMULATOR)
+#include "enc28j60_emu.h"        // 在主机上运行：SPI 与片选接到 enc28j60_emu.c 的寄存器模型
+#else
 #include "stm32f10x.h"
 #include "stm32f10x_conf.h"
+#endif
   
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // ENC28J60 Control Registers
@@ -235,8 +239,9 @@
 //
 // start with recbuf at 0/
 #define RXSTART_INIT     0x0
-// receive buffer end
-#define RXSTOP_INIT      0x800
+// receive buffer end: 用到发送缓冲区之前的全部空间，可以容纳更多的帧，由一次中断批量取出；
+// ERXND 取奇数，使接收缓冲区大小为偶数，回绕后帧仍从偶地址开始
+#define RXSTOP_INIT      (TXSTART_INIT-2)
 // start TX buffer at 0x1FFF-0x0600, pace for one full ethernet frame (0~1518 bytes)
 #define TXSTART_INIT     (0x1FFF-3*1518)
 // stp TX buffer at end of mem
@@ -246,6 +251,13 @@
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   
   
+#if defined(ENC28J60_EMULATOR)
+#define SPI2_ReadWriteByte(TxData)  enc28j60_emu_spi(TxData)
+#define ENC28J60_NO_SELECT()        enc28j60_emu_deselect()
+#define ENC28J60_SELECT()           enc28j60_emu_select()
+#define ENC28J60_RST_SET()
+#define ENC28J60_RST_CLEAR()        enc28j60_emu_reset()
+#else
 static inline u8 SPI2_ReadWriteByte(u8 TxData)
 {       
     //Fill output buffer with data
@@ -272,6 +284,8 @@ static inline u8 SPI2_ReadWriteByte(u8 TxData)
 #define ENC28J60_RST_PIN			GPIO_Pin_5
 #define ENC28J60_RST_SET()			GPIOC->BSRR = GPIO_Pin_5
 #define ENC28J60_RST_CLEAR()		GPIOC->BRR = GPIO_Pin_5
+#endif
+
 //SPI1初始化
 void ENC28J60_Reset(void);
 u8 ENC28J60_Read_Op(u8 op,u8 addr);
@@ -286,6 +300,9 @@ u8 ENC28J60_Init(u8* macaddr);
 u8 ENC28J60_Get_EREVID(void);
 void ENC28J60_Packet_Send(u32 len,u8* packet);
 u32 ENC28J60_Packet_Receive(u32 maxlen,u8* packet);  
+u8 ENC28J60_Packet_Count(void);
+u32 ENC28J60_Packet_Read(u32 maxlen,u8* packet);
+void ENC28J60_Packet_Free(void);
 
 extern int NextPacketPtr;
 
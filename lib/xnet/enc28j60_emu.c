@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <string.h>
+#include "enc28j60_device.h"
+
+/**
+ * ENC28J60 的寄存器与 SPI 命令模型
+ * 只模拟 enc28j60_device.c 用到的部分：控制寄存器（4 个 bank + 公共寄存器）、8KB 缓冲区、
+ * RCR/RBM/WCR/WBM/BFS/BFC/SRC 七条 SPI 命令、接收环形缓冲区与过滤器、PHY 写入和发送。
+ * 发送与 PHY 操作立即完成，MISTAT.BUSY 永远为 0
+ */
+#define EMU_MEM_MASK            (ENC28J60_EMU_MEM_SIZE - 1)
+#define EMU_RSV_SIZE            6               // 接收缓冲区中每帧前的下一帧指针与状态向量
+#define EMU_CRC_SIZE            4
+#define EMU_TSV_SIZE            7               // 发送后写在 ETXND 之后的发送状态向量
+#define EMU_MIN_FRAME           60
+
+typedef enum _emu_state_t {
+    EMU_IDLE,                                   // 未选中，或命令已结束
+    EMU_OPCODE,                                 // 等待命令字节
+    EMU_READ_REG,
+    EMU_READ_BUF,
+    EMU_WRITE_REG,
+    EMU_WRITE_BUF,
+    EMU_BIT_SET,
+    EMU_BIT_CLR,
+} emu_state_t;
+
+static uint8_t regs[4][32];                     // 公共寄存器 0x1B~0x1F 只存放在 regs[0] 中
+static uint8_t mem[ENC28J60_EMU_MEM_SIZE];
+static uint16_t phy[32];
+static emu_state_t state;
+static uint8_t reg_addr;                        // 当前命令的寄存器地址
+static uint8_t dummy_pending;                   // MAC/MII 寄存器读出的第一个字节是无效字节
+static enc28j60_emu_tx_t tx_handler;
+static void * tx_arg;
+static uint8_t tx_frame[ENC28J60_EMU_MEM_SIZE];
+static enc28j60_emu_stats_t emu_stats;
+
+static uint8_t * emu_reg (uint8_t bank, uint8_t addr) {
+    addr &= ADDR_MASK;
+    return &regs[(addr >= EIE) ? 0 : bank][addr];
+}
+
+// 按 enc28j60_device.h 中的寄存器名访问，不受当前 bank 影响
+#define REG(name)               (*emu_reg(((name) & BANK_MASK) >> 5, (name)))
+#define REG16(name)             ((uint16_t)(REG(name) | (REG((name) + 1) << 8)))
+#define REG16_SET(name, v)      do { REG(name) = (uint8_t)(v); REG((name) + 1) = (uint8_t)((v) >> 8); } while (0)
+
+static uint8_t emu_bank (void) {
+    return REG(ECON1) & (ECON1_BSEL1 | ECON1_BSEL0);
+}
+
+/**
+ * 是否为 MAC/MII 寄存器：读出时前面多一个无效字节，且不支持 BFS/BFC
+ */
+static int emu_is_mac_mii (uint8_t bank, uint8_t addr) {
+    if (addr >= EIE) {
+        return 0;
+    }
+    return (bank == 2) || ((bank == 3) && ((addr <= (MAADR4 & ADDR_MASK)) || (addr == (MISTAT & ADDR_MASK))));
+}
+
+/**
+ * 上电或软件复位后的寄存器状态
+ */
+void enc28j60_emu_reset (void) {
+    memset(regs, 0, sizeof(regs));
+    memset(phy, 0, sizeof(phy));
+    REG(ECON2) = ECON2_AUTOINC;
+    REG(ESTAT) = ESTAT_CLKRDY;
+    REG16_SET(ERDPTL, 0x05FA);
+    REG16_SET(ERXSTL, 0x05FA);
+    REG16_SET(ERXNDL, 0x1FFF);
+    REG16_SET(ERXRDPTL, 0x05FA);
+    REG(ERXFCON) = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN;
+    REG(MACON2) = MACON2_MARST;
+    REG(EREVID) = 0x06;                         // Rev. B7
+    state = EMU_IDLE;
+}
+
+/**
+ * 初始化模型
+ * @param tx 芯片发出帧时的回调
+ * @param arg 回调参数
+ */
+void enc28j60_emu_init (enc28j60_emu_tx_t tx, void * arg) {
+    tx_handler = tx;
+    tx_arg = arg;
+    memset(&emu_stats, 0, sizeof(emu_stats));
+    memset(mem, 0, sizeof(mem));
+    enc28j60_emu_reset();
+}
+
+/**
+ * 接收缓冲区内的下一个地址，到 ERXND 后回到 ERXST
+ */
+static uint16_t emu_rx_next (uint16_t addr) {
+    if (addr == REG16(ERXNDL)) {
+        return REG16(ERXSTL);
+    }
+    return (uint16_t)((addr + 1) & EMU_MEM_MASK);
+}
+
+/**
+ * 按 ETXST~ETXND 发出一帧：第一个字节是每包控制字节，其后是帧数据
+ */
+static void emu_transmit (void) {
+    uint16_t start = REG16(ETXSTL);
+    uint16_t end = REG16(ETXNDL);
+    uint32_t size = (uint32_t)((end - start) & EMU_MEM_MASK);
+    uint8_t control = mem[start];
+    uint8_t pad = (control & PKTCTRL_POVERRIDE) ? (control & PKTCTRL_PPADEN) : (REG(MACON3) & MACON3_PADCFG0);
+    uint16_t tsv = (uint16_t)((end + 1) & EMU_MEM_MASK);
+
+    for (uint32_t i = 0; i < size; i++) {
+        tx_frame[i] = mem[(start + 1 + i) & EMU_MEM_MASK];
+    }
+    if (pad && (size < EMU_MIN_FRAME)) {
+        memset(tx_frame + size, 0, EMU_MIN_FRAME - size);
+        size = EMU_MIN_FRAME;
+    }
+
+    if (tx_handler) {
+        tx_handler(tx_arg, tx_frame, size);
+    }
+    emu_stats.tx_frames++;
+
+    // 发送状态向量：字节数与“发送完成”位
+    for (uint32_t i = 0; i < EMU_TSV_SIZE; i++) {
+        mem[(tsv + i) & EMU_MEM_MASK] = 0;
+    }
+    mem[tsv] = (uint8_t)size;
+    mem[(tsv + 1) & EMU_MEM_MASK] = (uint8_t)(size >> 8);
+    mem[(tsv + 2) & EMU_MEM_MASK] = 0x80;
+
+    REG(ECON1) &= ~ECON1_TXRTS;
+    REG(EIR) |= EIR_TXIF;
+}
+
+/**
+ * 写入控制寄存器后的副作用
+ */
+static void emu_reg_written (uint8_t bank, uint8_t addr, uint8_t old) {
+    uint8_t value = *emu_reg(bank, addr);
+
+    if (addr == ECON1) {
+        if ((old ^ value) & (ECON1_BSEL1 | ECON1_BSEL0)) {
+            emu_stats.bank_switches++;
+        }
+        if ((value & ECON1_TXRTS) && !(old & ECON1_TXRTS)) {
+            emu_transmit();
+        }
+    } else if (addr == ECON2) {
+        if (value & ECON2_PKTDEC) {
+            REG(ECON2) &= ~ECON2_PKTDEC;
+            if (REG(EPKTCNT) > 0) {
+                REG(EPKTCNT)--;
+            }
+            if (REG(EPKTCNT) == 0) {
+                REG(EIR) &= ~EIR_PKTIF;
+            }
+        }
+    } else if ((bank == 0) && ((addr == ERXSTL) || (addr == ERXSTH))) {
+        // 设置接收起始地址时，硬件写指针随之复位
+        REG16_SET(ERXWRPTL, REG16(ERXSTL));
+    } else if ((bank == 0) && ((addr == ERXWRPTL) || (addr == ERXWRPTH))) {
+        *emu_reg(bank, addr) = old;             // 只读
+    } else if ((bank == 1) && (addr == (EPKTCNT & ADDR_MASK))) {
+        *emu_reg(bank, addr) = old;             // 只读，只能用 ECON2.PKTDEC 递减
+    } else if ((bank == 2) && (addr == (MIWRH & ADDR_MASK))) {
+        phy[REG(MIREGADR) & 0x1F] = REG16(MIWRL);
+    } else if ((bank == 2) && (addr == (MICMD & ADDR_MASK)) && (value & MICMD_MIIRD)) {
+        REG16_SET(MIRDL, phy[REG(MIREGADR) & 0x1F]);
+    }
+}
+
+/**
+ * 片选有效，开始一条 SPI 命令
+ */
+void enc28j60_emu_select (void) {
+    state = EMU_OPCODE;
+    emu_stats.spi_transactions++;
+}
+
+/**
+ * 片选无效，结束当前命令
+ */
+void enc28j60_emu_deselect (void) {
+    state = EMU_IDLE;
+}
+
+/**
+ * SPI 交换一个字节
+ * @param data 主机发出的字节
+ * @return 芯片同时返回的字节
+ */
+uint8_t enc28j60_emu_spi (uint8_t data) {
+    uint8_t bank = emu_bank();
+    uint8_t out = 0;
+    uint8_t old;
+
+    if (state == EMU_IDLE) {
+        return 0xFF;
+    }
+    emu_stats.spi_bytes++;
+
+    switch (state) {
+        case EMU_OPCODE:
+            reg_addr = data & ADDR_MASK;
+            if (data == ENC28J60_SOFT_RESET) {
+                enc28j60_emu_reset();
+                state = EMU_IDLE;
+            } else if (data == ENC28J60_READ_BUF_MEM) {
+                state = EMU_READ_BUF;
+            } else if (data == ENC28J60_WRITE_BUF_MEM) {
+                state = EMU_WRITE_BUF;
+            } else {
+                switch (data & 0xE0) {
+                    case ENC28J60_READ_CTRL_REG:
+                        dummy_pending = (uint8_t)emu_is_mac_mii(bank, reg_addr);
+                        state = EMU_READ_REG;
+                        break;
+                    case ENC28J60_WRITE_CTRL_REG:
+                        state = EMU_WRITE_REG;
+                        break;
+                    case ENC28J60_BIT_FIELD_SET:
+                    case ENC28J60_BIT_FIELD_CLR:
+                        if (emu_is_mac_mii(bank, reg_addr)) {
+                            fprintf(stderr, "enc28j60_emu: BFS/BFC on MAC/MII register %d:%02x ignored\n",
+                                    bank, reg_addr);
+                            state = EMU_IDLE;
+                        } else {
+                            state = ((data & 0xE0) == ENC28J60_BIT_FIELD_SET) ? EMU_BIT_SET : EMU_BIT_CLR;
+                        }
+                        break;
+                    default:
+                        state = EMU_IDLE;
+                        break;
+                }
+            }
+            break;
+        case EMU_READ_REG:
+            if (dummy_pending) {
+                dummy_pending = 0;
+            } else {
+                out = *emu_reg(bank, reg_addr);
+            }
+            break;
+        case EMU_READ_BUF: {
+            uint16_t rdpt = REG16(ERDPTL);
+
+            out = mem[rdpt];
+            if (REG(ECON2) & ECON2_AUTOINC) {
+                // 读指针在接收缓冲区内时按接收缓冲区回绕
+                REG16_SET(ERDPTL, emu_rx_next(rdpt));
+            }
+            break;
+        }
+        case EMU_WRITE_BUF: {
+            uint16_t wrpt = REG16(EWRPTL);
+
+            mem[wrpt] = data;
+            if (REG(ECON2) & ECON2_AUTOINC) {
+                REG16_SET(EWRPTL, (wrpt + 1) & EMU_MEM_MASK);
+            }
+            break;
+        }
+        case EMU_WRITE_REG:
+        case EMU_BIT_SET:
+        case EMU_BIT_CLR: {
+            uint8_t * reg = emu_reg(bank, reg_addr);
+
+            old = *reg;
+            if (state == EMU_WRITE_REG) {
+                *reg = data;
+            } else if (state == EMU_BIT_SET) {
+                *reg |= data;
+            } else {
+                *reg &= ~data;
+            }
+            emu_reg_written(bank, reg_addr, old);
+            state = EMU_IDLE;
+            break;
+        }
+        default:
+            break;
+    }
+
+    return out;
+}
+
+/**
+ * 按 EPMM/EPMCS/EPMO 计算模式匹配：掩码选中的字节依次拼接，按 IP 校验和的方式求和后取反
+ */
+static int emu_pattern_match (const uint8_t * frame, uint32_t size) {
+    uint16_t offset = REG16(EPMOL);
+    uint32_t sum = 0;
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < 64; i++) {
+        if (!(REG(EPMM0 + i / 8) & (1 << (i % 8)))) {
+            continue;
+        }
+        if (offset + i >= size) {
+            return 0;
+        }
+        sum += (count++ & 1) ? frame[offset + i] : (uint32_t)frame[offset + i] << 8;
+    }
+
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum == REG16(EPMCSL);
+}
+
+/**
+ * 按 ERXFCON 判断是否接收：未使能任何过滤器时接收所有帧；
+ * ANDOR 为 0 时任一过滤器通过即接收，为 1 时需全部通过
+ */
+static int emu_rx_accept (const uint8_t * frame, uint32_t size) {
+    static const uint8_t broadcast[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    uint8_t fcon = REG(ERXFCON);
+    uint8_t and_mode = (fcon & ERXFCON_ANDOR) != 0;
+    uint8_t mac[6];
+    int any = 0, all = 1;
+
+    fcon &= ERXFCON_UCEN | ERXFCON_PMEN | ERXFCON_MCEN | ERXFCON_BCEN | ERXFCON_HTEN | ERXFCON_MPEN;
+    if (fcon == 0) {
+        return 1;
+    }
+
+    mac[0] = REG(MAADR5);
+    mac[1] = REG(MAADR4);
+    mac[2] = REG(MAADR3);
+    mac[3] = REG(MAADR2);
+    mac[4] = REG(MAADR1);
+    mac[5] = REG(MAADR0);
+
+    for (uint8_t bit = 1; bit; bit <<= 1) {
+        int pass;
+
+        if (!(fcon & bit)) {
+            continue;
+        }
+        switch (bit) {
+            case ERXFCON_UCEN:
+                pass = memcmp(frame, mac, 6) == 0;
+                break;
+            case ERXFCON_BCEN:
+                pass = memcmp(frame, broadcast, 6) == 0;
+                break;
+            case ERXFCON_MCEN:
+                pass = (frame[0] & 1) && (memcmp(frame, broadcast, 6) != 0);
+                break;
+            case ERXFCON_PMEN:
+                pass = emu_pattern_match(frame, size);
+                break;
+            default:
+                pass = 0;                       // 哈希表与魔术包过滤不模拟
+                break;
+        }
+        any |= pass;
+        all &= pass;
+    }
+
+    return and_mode ? all : any;
+}
+
+/**
+ * 线缆上到达一帧：通过过滤器后连同状态向量写入接收缓冲区
+ * @param frame 帧数据，不含 CRC
+ * @param size 帧长度
+ * @return 1 - 已写入接收缓冲区，0 - 被过滤或丢弃，-1 - 接收缓冲区放不下
+ */
+int enc28j60_emu_receive (const uint8_t * frame, uint32_t size) {
+    uint16_t start = REG16(ERXSTL);
+    uint16_t end = REG16(ERXNDL);
+    uint32_t ring = (uint32_t)(end - start) + 1;
+    uint16_t wrpt = REG16(ERXWRPTL);
+    uint16_t rdpt = REG16(ERXRDPTL);
+    uint32_t count = size + EMU_CRC_SIZE;
+    uint32_t need = EMU_RSV_SIZE + count + (count & 1);
+    uint32_t space;
+    uint16_t next;
+    uint16_t addr;
+
+    if (!(REG(ECON1) & ECON1_RXEN) || (size < 14) || (count > REG16(MAMXFLL))) {
+        emu_stats.rx_dropped++;
+        return 0;
+    }
+    if (!emu_rx_accept(frame, size)) {
+        emu_stats.rx_filtered++;
+        return 0;
+    }
+
+    // 硬件写指针不能追上 ERXRDPT
+    space = (wrpt == rdpt) ? ring : (uint32_t)((rdpt + ring - wrpt) % ring);
+    if ((need >= space) || (REG(EPKTCNT) == 0xFF)) {
+        REG(EIR) |= EIR_RXERIF;
+        return -1;
+    }
+
+    next = (uint16_t)(start + (wrpt - start + need) % ring);
+    addr = wrpt;
+    mem[addr] = (uint8_t)next;
+    addr = emu_rx_next(addr);
+    mem[addr] = (uint8_t)(next >> 8);
+    addr = emu_rx_next(addr);
+    mem[addr] = (uint8_t)count;
+    addr = emu_rx_next(addr);
+    mem[addr] = (uint8_t)(count >> 8);
+    addr = emu_rx_next(addr);
+    mem[addr] = 0x80;                           // Received OK
+    addr = emu_rx_next(addr);
+    mem[addr] = (uint8_t)(((frame[0] & 1) ? 0x01 : 0) | ((frame[0] == 0xFF) ? 0x02 : 0));
+    addr = emu_rx_next(addr);
+    for (uint32_t i = 0; i < count; i++) {
+        mem[addr] = (i < size) ? frame[i] : 0;  // CRC 不计算，驱动不检查
+        addr = emu_rx_next(addr);
+    }
+
+    REG16_SET(ERXWRPTL, next);
+    REG(EPKTCNT)++;
+    REG(EIR) |= EIR_PKTIF;
+    emu_stats.rx_frames++;
+    return 1;
+}
+
+/**
+ * INT 引脚是否有效（低电平），即 MCU 的外部中断是否会触发
+ */
+int enc28j60_emu_int (void) {
+    return (REG(EIE) & EIE_INTIE) && (REG(EIR) & REG(EIE) & ~EIE_INTIE);
+}
+
+/**
+ * 取 SPI 及收发统计
+ */
+void enc28j60_emu_get_stats (enc28j60_emu_stats_t * stats) {
+    *stats = emu_stats;
+}
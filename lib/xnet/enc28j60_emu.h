@@ -0,0 +1,50 @@
+#ifndef ENC28J60_EMU_H
+#define ENC28J60_EMU_H
+
+#include <stdint.h>
+
+/**
+ * ENC28J60 的主机端寄存器/SPI 模型
+ * 在主机上编译 enc28j60_device.c 时（定义 ENC28J60_EMULATOR），SPI 收发字节与片选接到这里，
+ * 同一份固件驱动不改动就能在 Linux 上运行，用来测量每帧的 SPI 开销
+ */
+
+// 固件中使用的 STM32 标准库类型
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+// 芯片内部的以太网缓冲区大小
+#define ENC28J60_EMU_MEM_SIZE       8192
+
+/**
+ * 芯片把一帧发到线缆上
+ * @param arg enc28j60_emu_init 时传入的参数
+ * @param frame 帧数据，不含 CRC，只在回调期间有效
+ * @param size 帧长度
+ */
+typedef void (*enc28j60_emu_tx_t)(void * arg, const uint8_t * frame, uint32_t size);
+
+/**
+ * SPI 及收发统计，自初始化以来累计
+ */
+typedef struct _enc28j60_emu_stats_t {
+    uint32_t spi_transactions;          // 片选次数，每次对应一条 SPI 命令
+    uint32_t spi_bytes;                 // SPI 上交换的字节数，包括命令字节
+    uint32_t bank_switches;             // ECON1.BSEL 改变的次数
+    uint32_t rx_frames;                 // 写入接收缓冲区的帧数
+    uint32_t rx_filtered;               // 被接收过滤器丢弃的帧数
+    uint32_t rx_dropped;                // 接收缓冲区已满或未使能接收被丢弃的帧数
+    uint32_t tx_frames;                 // 发到线缆上的帧数
+} enc28j60_emu_stats_t;
+
+void enc28j60_emu_init(enc28j60_emu_tx_t tx, void * arg);
+void enc28j60_emu_reset(void);
+void enc28j60_emu_select(void);
+void enc28j60_emu_deselect(void);
+uint8_t enc28j60_emu_spi(uint8_t data);
+int enc28j60_emu_receive(const uint8_t * frame, uint32_t size);
+int enc28j60_emu_int(void);
+void enc28j60_emu_get_stats(enc28j60_emu_stats_t * stats);
+
+#endif //ENC28J60_EMU_H
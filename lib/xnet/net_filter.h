@@ -0,0 +1,24 @@
+#ifndef NET_FILTER_H
+#define NET_FILTER_H
+
+#include <stdint.h>
+
+// 过滤器中最多的本机 IP 地址数与上层协议数
+#define NET_FILTER_IP_MAX           4
+#define NET_FILTER_PROTOCOL_MAX     4
+
+/**
+ * 接收过滤条件，由协议栈按当前配置生成，驱动据此在内核中安装过滤器：
+ * 只接收目的 MAC 为本机或广播、且不是自己发出的帧，其中
+ * ARP 只接收目标 IP 为本机地址的（包括发给本机的请求与对本机请求的应答），
+ * IPv4 只接收目的地址为本机地址、且上层协议已启用的
+ */
+typedef struct _net_filter_t {
+    uint8_t mac[6];                                 // 本机 MAC
+    uint8_t ip[NET_FILTER_IP_MAX][4];               // 本机 IP 地址（网络字节序）
+    uint8_t ip_count;
+    uint8_t protocol[NET_FILTER_PROTOCOL_MAX];      // 启用的 IP 上层协议号，为空时接收所有协议
+    uint8_t protocol_count;
+} net_filter_t;
+
+#endif //NET_FILTER_H
@@ -0,0 +1,15 @@
+#ifndef NET_IRQ_H
+#define NET_IRQ_H
+
+#include <stdint.h>
+
+/**
+ * 模拟网卡中断：驱动的接收线程每收到一帧调用一次
+ * @param arg 启动接收线程时传入的参数
+ * @param is_rx 1 - 收到的帧，0 - 发出的帧
+ * @param data 帧数据，只在回调期间有效
+ * @param size 帧长度
+ */
+typedef void (*irq_handler_t)(void* arg, uint8_t is_rx, const uint8_t* data, uint32_t size);
+
+#endif //NET_IRQ_H
@@ -0,0 +1,16 @@
+#ifndef NET_MTU_H
+#define NET_MTU_H
+
+/**
+ * 协议栈与驱动共用的 MTU 上限，决定数据包缓冲区与驱动收发环中每帧槽的大小。
+ * 默认为以太网的 1500，用 CMake 选项 XNET_MTU（即 -DXNET_CFG_MTU=9000）编译为 jumbo 帧；
+ * 运行时可用 xnet_set_mtu() 在此范围内调小
+ */
+#ifndef XNET_CFG_MTU
+#define XNET_CFG_MTU                1500
+#endif
+
+// 驱动环中单帧槽的大小：最大帧加上驱动自己的帧头，按 2KB 取整，MTU 为 1500 时正好是 2048
+#define NET_FRAME_SLOT_SIZE         (((XNET_CFG_MTU) + 128 + 2047) & ~2047)
+
+#endif //NET_MTU_H
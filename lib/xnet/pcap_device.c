@@ -1,5 +1,10 @@
 ﻿#include <memory.h>
+#include <stdlib.h>
 #include "pcap_device.h"
+#if !defined(WIN32)
+#include <poll.h>
+#include <pthread.h>
+#endif
 
 #if defined(WIN32)
 
@@ -211,19 +216,44 @@ static int pcap_show_list(void) {
     return 0;
 }
 
+/**
+ * 填入缺省的打开选项：阻塞读取、非立即模式、libpcap 缺省的缓冲区与捕获长度、只收输入，
+ * 与 pcap_open_live 的行为相同
+ */
+void pcap_device_opt_init(pcap_device_opt_t* opt) {
+    memset(opt, 0, sizeof(pcap_device_opt_t));
+    opt->buffer_size = PCAP_DEVICE_BUFFER_SIZE;
+    opt->snaplen = PCAP_DEVICE_SNAPLEN;
+    opt->direction = PCAP_D_IN;
+}
+
 /**
  * 打开pcap设备接口
  * @param ip 打开网卡的指定ip
  * @param 给网卡设置mac
+ * @param poll_mode 非 0 时以非阻塞方式读取，配合 pcap_device_wait 等待数据包；
+ *                  为 0 时读取会阻塞到有数据包为止
  */
 pcap_t* pcap_device_open(const char* ip, const uint8_t * mac_addr, uint8_t poll_mode) {
+    pcap_device_opt_t opt;
+
+    pcap_device_opt_init(&opt);
+    opt.poll_mode = poll_mode;
+    return pcap_device_open_opt(ip, mac_addr, &opt);
+}
+
+/**
+ * 按选项打开pcap设备接口
+ * @param ip 打开网卡的指定ip
+ * @param mac_addr 给网卡设置mac
+ * @param opt 打开选项
+ */
+pcap_t* pcap_device_open_opt(const char* ip, const uint8_t * mac_addr, const pcap_device_opt_t* opt) {
     char err_buf[PCAP_ERRBUF_SIZE];
-    struct bpf_program fp;
-    bpf_u_int32 mask;
-    bpf_u_int32 net;
-    char filter_exp[256];
     char name_buf[256];
+    net_filter_t filter;
     pcap_t* pcap;
+    int err;
 
     if (load_pcap_lib() < 0) {
         fprintf(stderr, "pcap_open: load pcap dll failed! install it first\n");
@@ -236,17 +266,8 @@ pcap_t* pcap_device_open(const char* ip, const uint8_t * mac_addr, uint8_t poll_
         return (pcap_t*)0;
     }
 
-    if (pcap_lookupnet(name_buf, &net, &mask, err_buf) == -1) {
-        printf("pcap_open: can't find use net card: %s\n", name_buf);
-        net = 0;
-        mask = 0;
-    }
-
-    pcap = pcap_open_live(name_buf,    // 设置字符串
-                          65536,  // 要捕获的最大字节数
-                          1, // 混杂模式
-                          0, // 读取超时（以毫秒为单位）
-                          err_buf);
+    // 用 pcap_create + pcap_activate 代替 pcap_open_live，才能在激活前设置立即模式与缓冲区大小
+    pcap = pcap_create(name_buf, err_buf);
     if (pcap == NULL) {
         fprintf(stderr, "pcap_open: create pcap failed %s\n net card name: %s\n", err_buf, name_buf);
         fprintf(stderr, "Use the following:\n");
@@ -254,30 +275,43 @@ pcap_t* pcap_device_open(const char* ip, const uint8_t * mac_addr, uint8_t poll_
         return (pcap_t*)0;
     }
 
-    // 非阻塞模式读取，程序中使用查询的方式读
-    if (pcap_setnonblock(pcap, 1, err_buf) != 0) {
+    pcap_set_snaplen(pcap, (int)opt->snaplen);     // 要捕获的最大字节数
+    pcap_set_promisc(pcap, 1);                      // 混杂模式
+    pcap_set_timeout(pcap, 0);                      // 读取超时（以毫秒为单位）
+    if (opt->buffer_size) {
+        pcap_set_buffer_size(pcap, (int)opt->buffer_size);
+    }
+    if (opt->immediate && (pcap_set_immediate_mode(pcap, 1) != 0)) {
+        fprintf(stderr, "pcap_open: immediate mode not support\n");
+    }
+
+    err = pcap_activate(pcap);
+    if (err < 0) {
+        fprintf(stderr, "pcap_open: activate %s failed: %s\n", name_buf, pcap_geterr(pcap));
+        pcap_close(pcap);
+        return (pcap_t*)0;
+    } else if (err > 0) {
+        fprintf(stderr, "pcap_open: activate %s warning: %s\n", name_buf, pcap_geterr(pcap));
+    }
+
+    // 查询模式下非阻塞读取，等待数据包由 pcap_device_wait 完成
+    if (pcap_setnonblock(pcap, opt->poll_mode ? 1 : 0, err_buf) != 0) {
         fprintf(stderr, "pcap_open: set none block failed: %s\n", pcap_geterr(pcap));
         return (pcap_t*)0;
     }
 
-    // 只捕获输入，不要捕获自己发出去的
-    // 注：win平台似乎不支持这个选项
-    if (pcap_setdirection(pcap, PCAP_D_IN) != 0) {
+    // 缺省只捕获输入，不要捕获自己发出去的
+    // 注：win平台似乎不支持这个选项，不支持时由下面的过滤器去掉自己发出的帧
+    if (pcap_setdirection(pcap, opt->direction) != 0) {
         // fprintf(stderr, "pcap_open: set direction not suppor: %s\n", pcap_geterr(pcap));
         
     }
 
-    // 只捕获发往本接口与广播的数据帧。相当于只处理发往这张网卡的包
-    sprintf(filter_exp,
-            "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
-            mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
-            mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-    if (pcap_compile(pcap, &fp, filter_exp, 0, net) == -1) {
-        printf("pcap_open: couldn't parse filter %s: %s\n", filter_exp, pcap_geterr(pcap));
-        return (pcap_t*)0;
-    }
-    if (pcap_setfilter(pcap, &fp) == -1) {
-        printf("pcap_open: couldn't install filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+    // 协议栈给出过滤条件之前，先只捕获发往本接口与广播的数据帧
+    memset(&filter, 0, sizeof(filter));
+    memcpy(filter.mac, mac_addr, sizeof(filter.mac));
+    if (pcap_device_set_filter(pcap, &filter) != 0) {
+        pcap_close(pcap);
         return (pcap_t*)0;
     }
 
@@ -309,6 +343,116 @@ uint32_t pcap_device_send(pcap_t* pcap, const uint8_t* buffer, uint32_t length)
     return 0;
 }
 
+/**
+ * 创建发送队列：帧先放入队列，flush 时一次交给驱动
+ * npcap 下使用 pcap_sendqueue，一次系统调用发出整个队列；
+ * 其它平台的 libpcap 没有批量发送接口，flush 时逐个调用 pcap_sendpacket
+ * @param depth 队列中最多容纳的帧数
+ * @param frame_size 单帧最大长度
+ */
+pcap_device_txq_t * pcap_device_txq_open(pcap_t * pcap, uint32_t depth, uint32_t frame_size) {
+    pcap_device_txq_t * txq = (pcap_device_txq_t *)calloc(1, sizeof(pcap_device_txq_t));
+    if (txq == (pcap_device_txq_t *)0) {
+        return (pcap_device_txq_t *)0;
+    }
+
+    txq->pcap = pcap;
+    txq->depth = depth;
+    txq->frame_size = frame_size;
+#if defined(WIN32)
+    txq->queue = pcap_sendqueue_alloc(depth * (sizeof(struct pcap_pkthdr) + frame_size));
+    if (txq->queue == (pcap_send_queue *)0) {
+        free(txq);
+        return (pcap_device_txq_t *)0;
+    }
+#else
+    txq->buffer = (uint8_t *)malloc((size_t)depth * frame_size);
+    txq->lengths = (uint32_t *)malloc(depth * sizeof(uint32_t));
+    if ((txq->buffer == (uint8_t *)0) || (txq->lengths == (uint32_t *)0)) {
+        pcap_device_txq_close(txq);
+        return (pcap_device_txq_t *)0;
+    }
+#endif
+    return txq;
+}
+
+/**
+ * 释放发送队列，未发送的帧被丢弃
+ */
+void pcap_device_txq_close(pcap_device_txq_t * txq) {
+    if (txq == (pcap_device_txq_t *)0) {
+        return;
+    }
+
+#if defined(WIN32)
+    pcap_sendqueue_destroy(txq->queue);
+#else
+    free(txq->buffer);
+    free(txq->lengths);
+#endif
+    free(txq);
+}
+
+/**
+ * 将数据包放入发送队列，队列满时先发送已有的帧
+ * @return 0 - 成功，-1 - 帧太大或放入队列失败
+ */
+int pcap_device_txq_send(pcap_device_txq_t * txq, const uint8_t* buffer, uint32_t length) {
+#if defined(WIN32)
+    struct pcap_pkthdr hdr;
+#endif
+
+    if (length > txq->frame_size) {
+        fprintf(stderr, "pcap send: pcaket size %d too large\n", length);
+        return -1;
+    }
+
+    if (txq->count >= txq->depth) {
+        pcap_device_txq_flush(txq);
+    }
+
+#if defined(WIN32)
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.caplen = length;
+    hdr.len = length;
+    if (pcap_sendqueue_queue(txq->queue, &hdr, buffer) != 0) {
+        fprintf(stderr, "pcap send: queue packet failed!\n");
+        return -1;
+    }
+#else
+    memcpy(txq->buffer + (size_t)txq->count * txq->frame_size, buffer, length);
+    txq->lengths[txq->count] = length;
+#endif
+    txq->count++;
+    return 0;
+}
+
+/**
+ * 一次发送队列中所有的帧
+ * @return 发送的帧数
+ */
+uint32_t pcap_device_txq_flush(pcap_device_txq_t * txq) {
+    uint32_t count = txq->count;
+
+    if (count == 0) {
+        return 0;
+    }
+
+#if defined(WIN32)
+    if (pcap_sendqueue_transmit(txq->pcap, txq->queue, 0) < txq->queue->len) {
+        fprintf(stderr, "pcap flush: send queue failed!:%s\n", pcap_geterr(txq->pcap));
+    }
+    txq->queue->len = 0;
+#else
+    for (uint32_t i = 0; i < count; i++) {
+        pcap_device_send(txq->pcap, txq->buffer + (size_t)i * txq->frame_size, txq->lengths[i]);
+    }
+#endif
+
+    txq->count = 0;
+    return count;
+}
+
 /**
  * 从网络接口读取数据包
  */
@@ -321,11 +465,246 @@ uint32_t pcap_device_read(pcap_t* pcap, uint8_t* buffer, uint32_t length) {
     if (err == 0) {
         return 0;
     } else if (err == 1) {     // 1 - 成功读取数据包, 0 - 没有数据包，其它值-出错
-        memcpy(buffer, pkt_data, pkthdr->len);
-        return pkthdr->len;
+        // 只有 caplen 字节被捕获，超过缓冲区或被截断的帧直接丢弃
+        if ((pkthdr->caplen > length) || (pkthdr->caplen < pkthdr->len)) {
+            return 0;
+        }
+        memcpy(buffer, pkt_data, pkthdr->caplen);
+        return pkthdr->caplen;
     }
 
     fprintf(stderr, "pcap_read: reading packet failed!:%s", pcap_geterr(pcap));
     return 0;
 }
 
+/**
+ * 从网络接口读取数据包，不拷贝，直接返回 pcap 内部缓冲区的地址
+ * 数据只读，在下一次读取之前有效
+ * @param length 捕获到的长度；帧被 snaplen 截断时为帧的原长度，大于 snaplen，调用者应丢弃
+ * @param timestamp 驱动收到该帧的时间（ns）
+ * @return 数据起始地址，没有数据包时返回 0
+ */
+const uint8_t* pcap_device_read_ref(pcap_t* pcap, uint32_t* length, uint64_t* timestamp) {
+    int err;
+    struct pcap_pkthdr* pkthdr;
+    const uint8_t* pkt_data;
+
+    err = pcap_next_ex(pcap, &pkthdr, &pkt_data);
+    if (err == 0) {
+        return (const uint8_t*)0;
+    } else if (err == 1) {
+        *length = (pkthdr->caplen < pkthdr->len) ? pkthdr->len : pkthdr->caplen;
+        *timestamp = (uint64_t)pkthdr->ts.tv_sec * 1000000000ULL + (uint64_t)pkthdr->ts.tv_usec * 1000;
+        return pkt_data;
+    }
+
+    fprintf(stderr, "pcap_read: reading packet failed!:%s", pcap_geterr(pcap));
+    return (const uint8_t*)0;
+}
+
+/**
+ * 等待网络接口有数据包可读
+ * Windows 上等待 npcap 的读事件，其它平台上等待 pcap_get_selectable_fd() 可读
+ * @param timeout_ms 最长等待时间，-1 表示一直等待
+ * @return 1 - 有数据包可读，0 - 超时或出错
+ */
+int pcap_device_wait(pcap_t* pcap, int timeout_ms) {
+#if defined(WIN32)
+    HANDLE event = pcap_getevent(pcap);
+
+    return WaitForSingleObject(event, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms) == WAIT_OBJECT_0;
+#else
+    struct pollfd pfd;
+
+    pfd.fd = pcap_get_selectable_fd(pcap);
+    if (pfd.fd < 0) {
+        return 1;           // 不支持等待的设备，退化为查询
+    }
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, timeout_ms) > 0;
+#endif
+}
+
+/**
+ * 接收线程中的 pcap_dispatch 与其它线程中更换过滤器互斥，pcap 句柄本身不是线程安全的
+ */
+#if defined(WIN32)
+static SRWLOCK rx_lock = SRWLOCK_INIT;
+#define pcap_rx_lock()          AcquireSRWLockExclusive(&rx_lock)
+#define pcap_rx_unlock()        ReleaseSRWLockExclusive(&rx_lock)
+#else
+static pthread_mutex_t rx_lock = PTHREAD_MUTEX_INITIALIZER;
+#define pcap_rx_lock()          pthread_mutex_lock(&rx_lock)
+#define pcap_rx_unlock()        pthread_mutex_unlock(&rx_lock)
+#endif
+
+/**
+ * 按过滤条件生成过滤表达式：
+ * (ether dst 本机 or ether broadcast) and not ether src 本机
+ * and ((arp and arp[24:4] = 本机 IP) or (ip and (dst host 本机 IP) and (ip proto ...)))
+ * 没有 IP 地址时不检查 ARP 与 IPv4 的地址
+ */
+static void pcap_filter_format(char* buf, size_t size, const net_filter_t* filter) {
+    const uint8_t* mac = filter->mac;
+    size_t len;
+
+    len = snprintf(buf, size,
+            "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)"
+            " and ((arp",
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+            mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    for (int i = 0; (i < filter->ip_count) && (len < size); i++) {
+        const uint8_t* ip = filter->ip[i];
+        len += snprintf(buf + len, size - len, "%sarp[24:4] = 0x%02x%02x%02x%02x",
+                        i ? " or " : " and (", ip[0], ip[1], ip[2], ip[3]);
+    }
+    if (filter->ip_count && (len < size)) {
+        len += snprintf(buf + len, size - len, ")");
+    }
+
+    if (len < size) {
+        len += snprintf(buf + len, size - len, ") or (ip");
+    }
+    for (int i = 0; (i < filter->ip_count) && (len < size); i++) {
+        const uint8_t* ip = filter->ip[i];
+        len += snprintf(buf + len, size - len, "%sdst host %d.%d.%d.%d",
+                        i ? " or " : " and (", ip[0], ip[1], ip[2], ip[3]);
+    }
+    if (filter->ip_count && (len < size)) {
+        len += snprintf(buf + len, size - len, ")");
+    }
+    for (int i = 0; (i < filter->protocol_count) && (len < size); i++) {
+        len += snprintf(buf + len, size - len, "%sip proto %d", i ? " or " : " and (", filter->protocol[i]);
+    }
+    if (filter->protocol_count && (len < size)) {
+        len += snprintf(buf + len, size - len, ")");
+    }
+    if (len < size) {
+        snprintf(buf + len, size - len, "))");
+    }
+}
+
+/**
+ * 按协议栈给出的条件编译并安装过滤器，替换已安装的过滤器，地址改变后调用。
+ * 接收线程运行时与 pcap_dispatch 互斥
+ * @return 0 - 成功，其它失败
+ */
+int pcap_device_set_filter(pcap_t* pcap, const net_filter_t* filter) {
+    char filter_exp[PCAP_DEVICE_FILTER_SIZE];
+    struct bpf_program fp;
+    int err = 0;
+
+    pcap_filter_format(filter_exp, sizeof(filter_exp), filter);
+    if (pcap_compile(pcap, &fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) == -1) {
+        printf("pcap_set_filter: couldn't parse filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+        return -1;
+    }
+
+    pcap_rx_lock();
+    if (pcap_setfilter(pcap, &fp) == -1) {
+        printf("pcap_set_filter: couldn't install filter %s: %s\n", filter_exp, pcap_geterr(pcap));
+        err = -1;
+    }
+    pcap_rx_unlock();
+
+    pcap_freecode(&fp);
+    return err;
+}
+
+/**
+ * 读取内核/驱动的接收统计，数值自打开以来累计
+ * @return 0 - 成功，其它 - 不支持或出错
+ */
+int pcap_device_stats(pcap_t* pcap, pcap_device_stats_t* stats) {
+    struct pcap_stat ps;
+
+    if (pcap_stats(pcap, &ps) != 0) {
+        return -1;
+    }
+
+    stats->recv = ps.ps_recv;
+    stats->drop = ps.ps_drop;
+    stats->ifdrop = ps.ps_ifdrop;
+    return 0;
+}
+
+/**
+ * 接收线程的参数
+ */
+typedef struct _pcap_rx_t {
+    pcap_t* pcap;
+    irq_handler_t handler;
+    void* arg;
+} pcap_rx_t;
+
+static void pcap_rx_callback(u_char* user, const struct pcap_pkthdr* pkthdr, const u_char* pkt_data) {
+    pcap_rx_t* rx = (pcap_rx_t*)user;
+
+    // 被 snaplen 截断的帧直接丢弃
+    if (pkthdr->caplen < pkthdr->len) {
+        return;
+    }
+    rx->handler(rx->arg, 1, pkt_data, pkthdr->caplen);
+}
+
+#if defined(WIN32)
+static DWORD WINAPI pcap_rx_thread(LPVOID param) {
+#else
+static void* pcap_rx_thread(void* param) {
+#endif
+    pcap_rx_t* rx = (pcap_rx_t*)param;
+
+    // 非阻塞模式下 pcap_dispatch 没有数据包时立即返回，先等待再取
+    for (;;) {
+        int count;
+
+        pcap_device_wait(rx->pcap, -1);
+        pcap_rx_lock();
+        count = pcap_dispatch(rx->pcap, -1, pcap_rx_callback, (u_char*)rx);
+        pcap_rx_unlock();
+        if (count < 0) {
+            fprintf(stderr, "pcap_rx: reading packet failed!:%s\n", pcap_geterr(rx->pcap));
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * 启动接收线程：每收到一帧调用一次 handler，线程随进程退出。
+ * 启动后不能再调用 pcap_device_read*，发送仍在调用者的线程中进行
+ * @return 0 - 成功，其它失败
+ */
+int pcap_device_start_rx(pcap_t* pcap, irq_handler_t handler, void* arg) {
+    pcap_rx_t* rx = (pcap_rx_t*)malloc(sizeof(pcap_rx_t));
+#if defined(WIN32)
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+
+    if (rx == (pcap_rx_t*)0) {
+        return -1;
+    }
+
+    rx->pcap = pcap;
+    rx->handler = handler;
+    rx->arg = arg;
+#if defined(WIN32)
+    thread = CreateThread(NULL, 0, pcap_rx_thread, rx, 0, NULL);
+    if (thread == NULL) {
+#else
+    if (pthread_create(&thread, NULL, pcap_rx_thread, rx) != 0) {
+#endif
+        fprintf(stderr, "pcap_start_rx: create rx thread failed\n");
+        free(rx);
+        return -1;
+    }
+#if defined(WIN32)
+    CloseHandle(thread);
+#else
+    pthread_detach(thread);
+#endif
+    return 0;
+}
@@ -3,16 +3,71 @@
 
 #include <pcap.h>
 #include <stdint.h>
+#include "net_irq.h"
+#include "net_filter.h"
 
 // 主-次版本号
 #define NPCAP_VERSION_M             0
 #define NPCAP_VERSION_N             9986
 
-typedef void (*irq_handler_t)(void* arg, uint8_t is_rx, const uint8_t* data, uint32_t size);
+// 缺省的捕获长度与内核缓冲区大小
+#define PCAP_DEVICE_SNAPLEN         65536
+#define PCAP_DEVICE_BUFFER_SIZE     (2 * 1024 * 1024)
 
+// 过滤表达式的最大长度
+#define PCAP_DEVICE_FILTER_SIZE     1024
+
+/**
+ * 打开选项，先用 pcap_device_opt_init 填入缺省值再按需修改
+ */
+typedef struct _pcap_device_opt_t {
+    uint8_t poll_mode;                  // 非 0 时以非阻塞方式读取，配合 pcap_device_wait 等待数据包
+    uint8_t immediate;                  // 立即模式：帧一到达就交给用户，不在内核中攒满缓冲区或等超时
+    uint32_t buffer_size;               // 内核缓冲区大小（字节），太小时突发流量会被内核丢弃
+    uint32_t snaplen;                   // 每帧最多捕获的字节数，超过的帧被截断
+    pcap_direction_t direction;         // 捕获方向：PCAP_D_IN 只收输入，PCAP_D_INOUT 收发都要
+} pcap_device_opt_t;
+
+/**
+ * 内核/驱动的接收统计，来自 pcap_stats()
+ */
+typedef struct _pcap_device_stats_t {
+    uint32_t recv;                      // 通过过滤器的帧数
+    uint32_t drop;                      // 缓冲区满被内核丢弃的帧数
+    uint32_t ifdrop;                    // 被网卡或其驱动丢弃的帧数，部分平台不支持
+} pcap_device_stats_t;
+
+/**
+ * 发送队列
+ */
+typedef struct _pcap_device_txq_t {
+    pcap_t* pcap;
+    uint32_t depth;                     // 最多容纳的帧数
+    uint32_t frame_size;                // 单帧最大长度
+    uint32_t count;                     // 当前队列中的帧数
+#if defined(WIN32)
+    pcap_send_queue* queue;
+#else
+    uint8_t* buffer;
+    uint32_t* lengths;
+#endif
+} pcap_device_txq_t;
+
+void pcap_device_opt_init(pcap_device_opt_t* opt);
 pcap_t* pcap_device_open(const char* ip, const uint8_t *mac_addr, uint8_t poll_mode);
+pcap_t* pcap_device_open_opt(const char* ip, const uint8_t *mac_addr, const pcap_device_opt_t* opt);
+int pcap_device_set_filter(pcap_t* pcap, const net_filter_t* filter);
+int pcap_device_stats(pcap_t* pcap, pcap_device_stats_t* stats);
+int pcap_device_start_rx(pcap_t* pcap, irq_handler_t handler, void* arg);
 void pcap_device_close(pcap_t* pcap);
 uint32_t pcap_device_send(pcap_t* pcap, const uint8_t* buffer, uint32_t length);
 uint32_t pcap_device_read(pcap_t* pcap, uint8_t* buffer, uint32_t length);
+const uint8_t* pcap_device_read_ref(pcap_t* pcap, uint32_t* length, uint64_t* timestamp);
+int pcap_device_wait(pcap_t* pcap, int timeout_ms);
+
+pcap_device_txq_t* pcap_device_txq_open(pcap_t* pcap, uint32_t depth, uint32_t frame_size);
+void pcap_device_txq_close(pcap_device_txq_t* txq);
+int pcap_device_txq_send(pcap_device_txq_t* txq, const uint8_t* buffer, uint32_t length);
+uint32_t pcap_device_txq_flush(pcap_device_txq_t* txq);
 
 #endif //PCAP_DRIVER_H
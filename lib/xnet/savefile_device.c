@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "savefile_device.h"
+
+/**
+ * pcap 抓包文件回放驱动
+ * 从 .pcap 文件中逐帧读出数据包，协议栈发出的数据包写入另一个 .pcap 文件。
+ * 文件格式自行解析，不依赖 libpcap，支持微秒/纳秒精度及两种字节序，链路类型须为以太网
+ */
+#define PCAP_MAGIC_US           0xA1B2C3D4
+#define PCAP_MAGIC_NS           0xA1B23C4D
+#define PCAP_LINKTYPE_ETHERNET  1
+
+#define NS_PER_SEC              1000000000ULL
+
+#pragma pack(1)
+typedef struct _pcap_file_hdr_t {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_hdr_t;
+
+typedef struct _pcap_rec_hdr_t {
+    uint32_t ts_sec;
+    uint32_t ts_frac;                   // 微秒或纳秒，取决于文件头
+    uint32_t caplen;
+    uint32_t len;
+} pcap_rec_hdr_t;
+#pragma pack()
+
+struct _savefile_device_t {
+    FILE * in;
+    FILE * out;
+    uint8_t mode;
+    uint8_t swapped;                    // 文件字节序与本机相反
+    uint8_t nsec;                       // 时间戳为纳秒精度
+    uint8_t eof;
+
+    uint8_t pending;                    // frame 中已预读了下一帧
+    uint32_t frame_len;
+    uint64_t frame_ts;                  // 下一帧的抓包时间，ns
+    uint8_t frame[SAVEFILE_FRAME_SIZE];
+
+    uint8_t started;
+    uint64_t first_ts;                  // 第一帧的抓包时间
+    uint64_t start_ns;                  // 第一帧读出时的本机时间
+    uint64_t replay_ts;                 // 回放时间轴上的当前时间，用作发出帧的时间戳
+};
+
+static uint64_t savefile_now_ns(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * NS_PER_SEC
+         + (uint64_t)(count.QuadPart % freq.QuadPart) * NS_PER_SEC / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+static uint32_t swap32(uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xFF00) | ((v << 8) & 0xFF0000) | (v << 24);
+}
+
+static uint32_t file32(savefile_device_t * dev, uint32_t v) {
+    return dev->swapped ? swap32(v) : v;
+}
+
+/**
+ * 预读下一帧到 dev->frame，过长的帧被跳过
+ * @return 1 - 读到一帧，0 - 文件结束
+ */
+static int savefile_load_next(savefile_device_t * dev) {
+    pcap_rec_hdr_t hdr;
+
+    while (!dev->eof) {
+        uint32_t caplen;
+
+        if (fread(&hdr, sizeof(hdr), 1, dev->in) != 1) {
+            dev->eof = 1;
+            break;
+        }
+
+        caplen = file32(dev, hdr.caplen);
+        if (caplen > SAVEFILE_FRAME_SIZE) {
+            fprintf(stderr, "savefile_read: skip %u bytes frame\n", caplen);
+            if (fseek(dev->in, caplen, SEEK_CUR) != 0) {
+                dev->eof = 1;
+            }
+            continue;
+        }
+
+        if (fread(dev->frame, 1, caplen, dev->in) != caplen) {
+            dev->eof = 1;
+            break;
+        }
+
+        dev->frame_len = caplen;
+        dev->frame_ts = (uint64_t)file32(dev, hdr.ts_sec) * NS_PER_SEC
+                      + (uint64_t)file32(dev, hdr.ts_frac) * (dev->nsec ? 1 : 1000);
+        dev->pending = 1;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * 打开抓包文件
+ * @param in_path 回放的输入文件
+ * @param out_path 保存发出数据包的文件，为 0 时丢弃发出的数据包
+ * @param mode SAVEFILE_MODE_MAX_SPEED 或 SAVEFILE_MODE_REAL_TIME
+ * @return 设备，失败返回 0
+ */
+savefile_device_t * savefile_device_open(const char * in_path, const char * out_path, uint8_t mode) {
+    savefile_device_t * dev;
+    pcap_file_hdr_t hdr;
+
+    dev = (savefile_device_t *)calloc(1, sizeof(savefile_device_t));
+    if (dev == (savefile_device_t *)0) {
+        fprintf(stderr, "savefile_open: alloc failed\n");
+        return (savefile_device_t *)0;
+    }
+    dev->mode = mode;
+
+    dev->in = fopen(in_path, "rb");
+    if (dev->in == (FILE *)0) {
+        fprintf(stderr, "savefile_open: open %s failed\n", in_path);
+        goto open_error;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, dev->in) != 1) {
+        fprintf(stderr, "savefile_open: %s is too short\n", in_path);
+        goto open_error;
+    }
+    if ((hdr.magic == PCAP_MAGIC_US) || (hdr.magic == PCAP_MAGIC_NS)) {
+        dev->nsec = hdr.magic == PCAP_MAGIC_NS;
+    } else if ((swap32(hdr.magic) == PCAP_MAGIC_US) || (swap32(hdr.magic) == PCAP_MAGIC_NS)) {
+        dev->swapped = 1;
+        dev->nsec = swap32(hdr.magic) == PCAP_MAGIC_NS;
+    } else {
+        fprintf(stderr, "savefile_open: %s is not a pcap file\n", in_path);
+        goto open_error;
+    }
+    if ((file32(dev, hdr.linktype) & 0xFFFF) != PCAP_LINKTYPE_ETHERNET) {
+        fprintf(stderr, "savefile_open: %s is not an ethernet capture\n", in_path);
+        goto open_error;
+    }
+
+    if (out_path) {
+        pcap_file_hdr_t out_hdr;
+
+        dev->out = fopen(out_path, "wb");
+        if (dev->out == (FILE *)0) {
+            fprintf(stderr, "savefile_open: create %s failed\n", out_path);
+            goto open_error;
+        }
+
+        memset(&out_hdr, 0, sizeof(out_hdr));
+        out_hdr.magic = dev->nsec ? PCAP_MAGIC_NS : PCAP_MAGIC_US;
+        out_hdr.version_major = 2;
+        out_hdr.version_minor = 4;
+        out_hdr.snaplen = SAVEFILE_FRAME_SIZE;
+        out_hdr.linktype = PCAP_LINKTYPE_ETHERNET;
+        fwrite(&out_hdr, sizeof(out_hdr), 1, dev->out);
+    }
+
+    return dev;
+open_error:
+    savefile_device_close(dev);
+    return (savefile_device_t *)0;
+}
+
+/**
+ * 关闭设备，输出文件随之写盘
+ */
+void savefile_device_close(savefile_device_t * dev) {
+    if (dev) {
+        if (dev->in) {
+            fclose(dev->in);
+        }
+        if (dev->out) {
+            fclose(dev->out);
+        }
+        free(dev);
+    }
+}
+
+/**
+ * 发送数据包：追加到输出文件，时间戳取回放时间轴上的当前时间，
+ * 极速模式下即最近读出那一帧的抓包时间，同一输入的输出文件每次都相同
+ * @return 写入的字节数，0 表示失败
+ */
+uint32_t savefile_device_send(savefile_device_t * dev, const uint8_t * buffer, uint32_t length) {
+    pcap_rec_hdr_t hdr;
+
+    if (dev->out == (FILE *)0) {
+        return length;
+    }
+
+    hdr.ts_sec = (uint32_t)(dev->replay_ts / NS_PER_SEC);
+    hdr.ts_frac = (uint32_t)(dev->replay_ts % NS_PER_SEC) / (dev->nsec ? 1 : 1000);
+    hdr.caplen = length;
+    hdr.len = length;
+    if ((fwrite(&hdr, sizeof(hdr), 1, dev->out) != 1)
+        || (fwrite(buffer, 1, length, dev->out) != length)) {
+        fprintf(stderr, "savefile_send: write failed\n");
+        return 0;
+    }
+
+    return length;
+}
+
+/**
+ * 读取下一帧。实时模式下未到抓包时的间隔时返回 0；
+ * 比 length 长的帧被丢弃
+ * @return 读到的字节数，没有数据包时返回 0
+ */
+uint32_t savefile_device_read(savefile_device_t * dev, uint8_t * buffer, uint32_t length) {
+    uint32_t size;
+
+    do {
+        if (!dev->pending && !savefile_load_next(dev)) {
+            return 0;
+        }
+
+        if (!dev->started) {
+            dev->started = 1;
+            dev->first_ts = dev->frame_ts;
+            dev->start_ns = savefile_now_ns();
+        }
+
+        if (dev->mode == SAVEFILE_MODE_REAL_TIME) {
+            uint64_t elapsed = savefile_now_ns() - dev->start_ns;
+            if (dev->frame_ts > dev->first_ts + elapsed) {
+                dev->replay_ts = dev->first_ts + elapsed;
+                return 0;
+            }
+        }
+
+        dev->pending = 0;
+        dev->replay_ts = dev->frame_ts;
+        size = dev->frame_len;
+    } while (size > length);
+
+    memcpy(buffer, dev->frame, size);
+    return size;
+}
+
+/**
+ * 输入文件是否已全部读出
+ */
+int savefile_device_eof(savefile_device_t * dev) {
+    return dev->eof && !dev->pending;
+}
+
+/**
+ * 等待下一帧到期：极速模式下立即返回，实时模式下休眠到下一帧的抓包间隔结束
+ * @param timeout_ms 最长等待时间
+ * @return 1 - 有帧可读，0 - 超时或文件已读完
+ */
+int savefile_device_wait(savefile_device_t * dev, int timeout_ms) {
+    uint64_t wait_ns;
+
+    if (!dev->pending && !savefile_load_next(dev)) {
+        return 0;
+    }
+    if ((dev->mode != SAVEFILE_MODE_REAL_TIME) || !dev->started) {
+        return 1;
+    }
+
+    wait_ns = dev->frame_ts - dev->first_ts;
+    if (wait_ns <= savefile_now_ns() - dev->start_ns) {
+        return 1;
+    }
+    wait_ns -= savefile_now_ns() - dev->start_ns;
+    if (wait_ns > (uint64_t)timeout_ms * 1000000) {
+        wait_ns = (uint64_t)timeout_ms * 1000000;
+    }
+#if defined(_WIN32)
+    Sleep((DWORD)((wait_ns + 999999) / 1000000));
+#else
+    usleep((useconds_t)((wait_ns + 999) / 1000));
+#endif
+    return savefile_now_ns() - dev->start_ns >= dev->frame_ts - dev->first_ts;
+}
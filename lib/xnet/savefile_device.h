@@ -0,0 +1,21 @@
+#ifndef SAVEFILE_DRIVER_H
+#define SAVEFILE_DRIVER_H
+
+#include <stdint.h>
+
+// 回放模式
+#define SAVEFILE_MODE_MAX_SPEED     0           // 尽可能快地读出
+#define SAVEFILE_MODE_REAL_TIME     1           // 按抓包时的间隔读出
+
+#define SAVEFILE_FRAME_SIZE         65536       // 单帧最大长度
+
+typedef struct _savefile_device_t savefile_device_t;
+
+savefile_device_t * savefile_device_open(const char * in_path, const char * out_path, uint8_t mode);
+void savefile_device_close(savefile_device_t * dev);
+uint32_t savefile_device_send(savefile_device_t * dev, const uint8_t * buffer, uint32_t length);
+uint32_t savefile_device_read(savefile_device_t * dev, uint8_t * buffer, uint32_t length);
+int savefile_device_eof(savefile_device_t * dev);
+int savefile_device_wait(savefile_device_t * dev, int timeout_ms);
+
+#endif //SAVEFILE_DRIVER_H
@@ -0,0 +1,136 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * 单生产者/单消费者无锁帧环
+ * 每个槽固定大小，前 4 字节存放帧长度，数据区从 SPSC_SLOT_HEAD 处开始。生产者只写 head，消费者只写 tail，
+ * 两者分处不同的 cache line，跨线程使用时无需加锁
+ */
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+// x86/x64 上 volatile 读写本身具有 acquire/release 语义，只需阻止编译器重排
+#define spsc_load_acquire(p)        (*(volatile uint32_t *)(p))
+#define spsc_store_release(p, v)    do { _ReadWriteBarrier(); *(volatile uint32_t *)(p) = (v); } while (0)
+#else
+#define spsc_load_acquire(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define spsc_store_release(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#endif
+
+#define SPSC_CACHE_LINE             64
+
+// 槽头：4 字节长度之后再空 2 字节，数据区落在 2 mod 4 处（与协议栈的 XNET_PACKET_PAD 相同）。
+// 以太网帧直接放在数据区、或放在长度为 4 的整数倍的前缀之后时，IP 头按 4 字节对齐
+#define SPSC_SLOT_HEAD              (sizeof(uint32_t) + 2)
+
+typedef struct _spsc_ring_t {
+    uint32_t head;                              // 下一个写入的位置，只由生产者修改
+    uint8_t head_pad[SPSC_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t tail;                              // 下一个读出的位置，只由消费者修改
+    uint8_t tail_pad[SPSC_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t mask;                              // 槽数量 - 1，槽数量为 2 的幂
+    uint32_t slot_size;                         // 每个槽的大小，含槽头
+    uint8_t * slots;
+} spsc_ring_t;
+
+/**
+ * 初始化帧环
+ * @param slot_count 槽数量，必须为 2 的幂
+ * @param frame_size 单帧最大长度
+ * @return 0 - 成功，其它失败
+ */
+static inline int spsc_ring_init(spsc_ring_t * ring, uint32_t slot_count, uint32_t frame_size) {
+    memset(ring, 0, sizeof(spsc_ring_t));
+    if ((slot_count == 0) || (slot_count & (slot_count - 1))) {
+        return -1;
+    }
+
+    // 槽大小按 cache line 对齐，相邻槽不会共享同一行
+    ring->slot_size = (uint32_t)((SPSC_SLOT_HEAD + frame_size + SPSC_CACHE_LINE - 1) & ~(SPSC_CACHE_LINE - 1));
+    ring->mask = slot_count - 1;
+    ring->slots = (uint8_t *)malloc((size_t)slot_count * ring->slot_size);
+    return ring->slots ? 0 : -1;
+}
+
+static inline void spsc_ring_free(spsc_ring_t * ring) {
+    free(ring->slots);
+    ring->slots = (uint8_t *)0;
+}
+
+static inline uint8_t * spsc_ring_slot(spsc_ring_t * ring, uint32_t pos) {
+    return ring->slots + (size_t)(pos & ring->mask) * ring->slot_size;
+}
+
+/**
+ * 生产者：写入一帧
+ * @return 0 - 成功，-1 - 环已满或帧过长
+ */
+static inline int spsc_ring_push(spsc_ring_t * ring, const uint8_t * data, uint32_t length) {
+    uint32_t head = ring->head;
+    uint8_t * slot;
+
+    if ((head - spsc_load_acquire(&ring->tail) > ring->mask)
+        || (length > ring->slot_size - SPSC_SLOT_HEAD)) {
+        return -1;
+    }
+
+    slot = spsc_ring_slot(ring, head);
+    memcpy(slot, &length, sizeof(uint32_t));
+    memcpy(slot + SPSC_SLOT_HEAD, data, length);
+    spsc_store_release(&ring->head, head + 1);
+    return 0;
+}
+
+/**
+ * 生产者：取得下一个空槽用于原地写入，写完后调用 spsc_ring_commit
+ * @return 槽内数据区起始地址，最多可写 slot_size - SPSC_SLOT_HEAD 字节；环已满时返回 0
+ */
+static inline uint8_t * spsc_ring_reserve(spsc_ring_t * ring) {
+    uint32_t head = ring->head;
+
+    if (head - spsc_load_acquire(&ring->tail) > ring->mask) {
+        return (uint8_t *)0;
+    }
+    return spsc_ring_slot(ring, head) + SPSC_SLOT_HEAD;
+}
+
+/**
+ * 生产者：提交 spsc_ring_reserve 取得的槽，帧对消费者可见
+ */
+static inline void spsc_ring_commit(spsc_ring_t * ring, uint32_t length) {
+    uint32_t head = ring->head;
+
+    memcpy(spsc_ring_slot(ring, head), &length, sizeof(uint32_t));
+    spsc_store_release(&ring->head, head + 1);
+}
+
+/**
+ * 消费者：当前可读的帧数
+ */
+static inline uint32_t spsc_ring_count(spsc_ring_t * ring) {
+    return spsc_load_acquire(&ring->head) - ring->tail;
+}
+
+/**
+ * 消费者：查看第 index 个未读帧，不移出
+ * @return 帧起始地址，在 spsc_ring_pop 移出之前有效
+ */
+static inline const uint8_t * spsc_ring_peek(spsc_ring_t * ring, uint32_t index, uint32_t * length) {
+    const uint8_t * slot = spsc_ring_slot(ring, ring->tail + index);
+
+    memcpy(length, slot, sizeof(uint32_t));
+    return slot + SPSC_SLOT_HEAD;
+}
+
+/**
+ * 消费者：移出最早的 count 帧，槽交还给生产者
+ */
+static inline void spsc_ring_pop(spsc_ring_t * ring, uint32_t count) {
+    spsc_store_release(&ring->tail, ring->tail + count);
+}
+
+#endif //SPSC_RING_H
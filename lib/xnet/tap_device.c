@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/if_tun.h>
+#include "tap_device.h"
+
+/**
+ * 打开 TAP 设备接口，不存在时自动创建
+ * 创建后需在主机侧配置地址并启用，如：
+ *   ip addr add 192.168.75.1/24 dev tap0 && ip link set tap0 up
+ * @param if_name 网卡名称，如 "tap0"
+ * @param poll_mode 非 0 时以非阻塞方式读取
+ * @return 设备描述符，小于 0 表示失败
+ */
+int tap_device_open(const char * if_name, uint8_t poll_mode) {
+    struct ifreq ifr;
+    int fd;
+
+    fd = open("/dev/net/tun", O_RDWR | (poll_mode ? O_NONBLOCK : 0));
+    if (fd < 0) {
+        fprintf(stderr, "tap_open: open /dev/net/tun failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // 收发的都是完整的以太网帧，不要额外的包信息头
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+    if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+        fprintf(stderr, "tap_open: attach %s failed: %s\n", if_name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * 设置 TAP 网卡在主机侧的 MTU，jumbo 帧时主机才会发出超过 1500 字节的帧
+ * @param if_name 网卡名称
+ * @param mtu 新的 MTU
+ * @return 0 - 成功，其它失败
+ */
+int tap_device_set_mtu(const char * if_name, uint32_t mtu) {
+    struct ifreq ifr;
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    int err;
+
+    if (sock < 0) {
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, if_name, IFNAMSIZ - 1);
+    ifr.ifr_mtu = (int)mtu;
+    err = ioctl(sock, SIOCSIFMTU, &ifr);
+    if (err < 0) {
+        fprintf(stderr, "tap_open: set %s mtu %u failed: %s\n", if_name, mtu, strerror(errno));
+    }
+    close(sock);
+    return err < 0 ? -1 : 0;
+}
+
+/**
+ * 关闭 TAP 接口
+ */
+void tap_device_close(int fd) {
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/**
+ * 向网络接口发送数据包，一次 write 对应一帧
+ * @return 发送的字节数，0 表示失败
+ */
+uint32_t tap_device_send(int fd, const uint8_t * buffer, uint32_t length) {
+    ssize_t size = write(fd, buffer, length);
+    if (size < 0) {
+        fprintf(stderr, "tap send: send packet failed!:%s\n", strerror(errno));
+        return 0;
+    }
+
+    return (uint32_t)size;
+}
+
+/**
+ * 从网络接口读取数据包，一次 read 对应一帧
+ * @return 读到的字节数，没有数据包时返回 0
+ */
+uint32_t tap_device_read(int fd, uint8_t * buffer, uint32_t length) {
+    ssize_t size = read(fd, buffer, length);
+    if (size < 0) {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            fprintf(stderr, "tap_read: reading packet failed!:%s\n", strerror(errno));
+        }
+        return 0;
+    }
+
+    return (uint32_t)size;
+}
+
+/**
+ * 等待网络接口有数据包可读
+ * @param timeout_ms 最长等待时间，-1 表示一直等待
+ * @return 1 - 有数据包可读，0 - 超时或出错
+ */
+int tap_device_wait(int fd, int timeout_ms) {
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+/**
+ * 接收线程的参数
+ */
+typedef struct _tap_rx_t {
+    int fd;
+    irq_handler_t handler;
+    void * arg;
+} tap_rx_t;
+
+static void * tap_rx_thread(void * param) {
+    tap_rx_t * rx = (tap_rx_t *)param;
+    uint8_t frame[TAP_RX_FRAME_SIZE];
+
+    for (;;) {
+        uint32_t size;
+
+        tap_device_wait(rx->fd, -1);
+        while ((size = tap_device_read(rx->fd, frame, sizeof(frame))) > 0) {
+            rx->handler(rx->arg, 1, frame, size);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 启动接收线程：每收到一帧调用一次 handler，线程随进程退出。
+ * 启动后不能再调用 tap_device_read，发送仍在调用者的线程中进行
+ * @return 0 - 成功，其它失败
+ */
+int tap_device_start_rx(int fd, irq_handler_t handler, void * arg) {
+    tap_rx_t * rx = (tap_rx_t *)malloc(sizeof(tap_rx_t));
+    pthread_t thread;
+
+    if (rx == (tap_rx_t *)0) {
+        return -1;
+    }
+
+    rx->fd = fd;
+    rx->handler = handler;
+    rx->arg = arg;
+    if (pthread_create(&thread, NULL, tap_rx_thread, rx) != 0) {
+        fprintf(stderr, "tap_start_rx: create rx thread failed\n");
+        free(rx);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef TAP_DRIVER_H
+#define TAP_DRIVER_H
+
+#include <stdint.h>
+#include "net_irq.h"
+#include "net_mtu.h"
+
+// 接收线程的帧缓冲区大小
+#define TAP_RX_FRAME_SIZE           NET_FRAME_SLOT_SIZE
+
+int tap_device_open(const char * if_name, uint8_t poll_mode);
+int tap_device_set_mtu(const char * if_name, uint32_t mtu);
+void tap_device_close(int fd);
+uint32_t tap_device_send(int fd, const uint8_t * buffer, uint32_t length);
+uint32_t tap_device_read(int fd, uint8_t * buffer, uint32_t length);
+int tap_device_wait(int fd, int timeout_ms);
+int tap_device_start_rx(int fd, irq_handler_t handler, void * arg);
+
+#endif //TAP_DRIVER_H
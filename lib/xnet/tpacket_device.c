@@ -0,0 +1,751 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include "tpacket_device.h"
+#include "spsc_ring.h"
+
+/**
+ * AF_PACKET + PACKET_MMAP(TPACKET_V3) 驱动
+ * 接收环与发送环映射到同一块共享内存：前半部分为接收环，后半部分为发送环
+ * 接收时直接返回环中帧的地址，不做拷贝；帧在调用 tpacket_device_release 或下一次读取之前有效
+ */
+struct _tpacket_device_t {
+    int fd;
+    uint8_t * map;                      // 映射的环形缓冲区起始地址
+    size_t map_size;
+
+    uint8_t * rx_ring;                  // 接收环
+    uint32_t rx_block;                  // 当前正在处理的块
+    uint32_t rx_left;                   // 当前块中尚未取走的帧数
+    uint8_t rx_held;                    // 当前块是否被用户持有
+    struct tpacket3_hdr * rx_frame;     // 下一个要取的帧
+    uint8_t poll_mode;                  // 非 0 时读取不阻塞，为 0 时阻塞到有帧可读
+
+    uint8_t * tx_ring;                  // 发送环
+    uint32_t tx_index;                  // 下一个可用的发送帧
+    uint32_t tx_pending;                // 已放入发送环、尚未通知内核的帧数
+    uint8_t tx_stamping;                // 内核可回报软件发送时间戳
+    spsc_ring_t stamp_ring;             // 等待接收时从错误队列转存的时间戳与帧，等待者写、取时间戳者读
+
+    uint32_t stat_packets;              // 内核统计的累计值，内核每次读取后清零
+    uint32_t stat_drops;
+
+    char if_name[IF_NAMESIZE];
+    uint8_t if_rx_valid;                // 能读到网卡的接收计数
+    uint64_t if_rx_base;                // 绑定时网卡已收到的帧数
+};
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING      23
+#endif
+
+#define TPACKET_FILTER_ACCEPT       0x40000     // 通过过滤器的帧最多交给用户的字节数
+#define TPACKET_FILTER_MAX          (19 + 2 * NET_FILTER_IP_MAX + NET_FILTER_PROTOCOL_MAX)
+
+/**
+ * 生成过滤器的一条比较指令，跳转目标为指令的绝对位置
+ */
+static void tpacket_filter_jeq(struct sock_filter * code, uint32_t * n, uint32_t k, uint32_t jt, uint32_t jf) {
+    struct sock_filter insn = BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, k, (uint8_t)(jt - *n - 1), (uint8_t)(jf - *n - 1));
+    code[(*n)++] = insn;
+}
+
+static void tpacket_filter_stmt(struct sock_filter * code, uint32_t * n, uint16_t op, uint32_t k) {
+    struct sock_filter insn = BPF_STMT(op, k);
+    code[(*n)++] = insn;
+}
+
+static uint32_t tpacket_filter_ip(const uint8_t ip[4]) {
+    return ((uint32_t)ip[0] << 24) | ((uint32_t)ip[1] << 16) | ((uint32_t)ip[2] << 8) | ip[3];
+}
+
+/**
+ * 按过滤条件生成并安装经典 BPF 过滤器，替换已安装的过滤器
+ * 等价于 pcap 驱动中的 "(ether dst 本机 or ether broadcast) and not ether src 本机
+ * and ((arp and arp[24:4] = 本机 IP) or (ip dst host 本机 IP and (ip proto ...)))"
+ * 没有 IP 地址时不检查 ARP 与 IPv4 的地址
+ */
+static int tpacket_set_filter(int fd, const net_filter_t * filter) {
+    const uint8_t * mac = filter->mac;
+    uint32_t mac_lo = ((uint32_t)mac[2] << 24) | ((uint32_t)mac[3] << 16) | ((uint32_t)mac[4] << 8) | mac[5];
+    uint32_t mac_hi = ((uint32_t)mac[0] << 8) | mac[1];
+    struct sock_filter code[TPACKET_FILTER_MAX];
+    struct sock_fprog prog;
+    uint32_t ip_count = filter->ip_count;
+    uint32_t protocol_count = filter->protocol_count;
+    uint32_t l_src = 7, l_type = 11, l_arp = 14;
+    uint32_t l_ip, l_protocol, l_accept, l_reject;
+    uint32_t n = 0;
+
+    // 先算出各段的位置，所有跳转都只向前
+    if (ip_count > NET_FILTER_IP_MAX) {
+        ip_count = NET_FILTER_IP_MAX;
+    }
+    if (protocol_count > NET_FILTER_PROTOCOL_MAX) {
+        protocol_count = NET_FILTER_PROTOCOL_MAX;
+    }
+    l_ip = l_arp + (ip_count ? 1 + ip_count : 1);
+    l_protocol = l_ip + (ip_count ? 1 + ip_count : 0);
+    l_accept = l_protocol + (protocol_count ? 1 + protocol_count : 0);
+    l_reject = l_accept + 1;
+
+    // 目的 MAC 为本机或广播
+    tpacket_filter_stmt(code, &n, BPF_LD | BPF_W | BPF_ABS, 2);
+    tpacket_filter_jeq(code, &n, mac_lo, n + 1, n + 3);
+    tpacket_filter_stmt(code, &n, BPF_LD | BPF_H | BPF_ABS, 0);
+    tpacket_filter_jeq(code, &n, mac_hi, l_src, l_reject);
+    tpacket_filter_jeq(code, &n, 0xFFFFFFFF, n + 1, l_reject);
+    tpacket_filter_stmt(code, &n, BPF_LD | BPF_H | BPF_ABS, 0);
+    tpacket_filter_jeq(code, &n, 0xFFFF, l_src, l_reject);
+
+    // 不是自己发出的
+    tpacket_filter_stmt(code, &n, BPF_LD | BPF_W | BPF_ABS, 8);
+    tpacket_filter_jeq(code, &n, mac_lo, n + 1, l_type);
+    tpacket_filter_stmt(code, &n, BPF_LD | BPF_H | BPF_ABS, 6);
+    tpacket_filter_jeq(code, &n, mac_hi, l_reject, l_type);
+
+    // 只要 ARP 与 IPv4
+    tpacket_filter_stmt(code, &n, BPF_LD | BPF_H | BPF_ABS, 12);
+    tpacket_filter_jeq(code, &n, ETH_P_ARP, l_arp, n + 1);
+    tpacket_filter_jeq(code, &n, ETH_P_IP, l_ip, l_reject);
+
+    // ARP 的目标 IP 为本机
+    if (ip_count) {
+        tpacket_filter_stmt(code, &n, BPF_LD | BPF_W | BPF_ABS, 14 + 24);
+        for (uint32_t i = 0; i < ip_count; i++) {
+            tpacket_filter_jeq(code, &n, tpacket_filter_ip(filter->ip[i]), l_accept,
+                               (i + 1 < ip_count) ? n + 1 : l_reject);
+        }
+    } else {
+        tpacket_filter_stmt(code, &n, BPF_RET | BPF_K, TPACKET_FILTER_ACCEPT);
+    }
+
+    // IPv4 的目的地址为本机
+    if (ip_count) {
+        tpacket_filter_stmt(code, &n, BPF_LD | BPF_W | BPF_ABS, 14 + 16);
+        for (uint32_t i = 0; i < ip_count; i++) {
+            tpacket_filter_jeq(code, &n, tpacket_filter_ip(filter->ip[i]), l_protocol,
+                               (i + 1 < ip_count) ? n + 1 : l_reject);
+        }
+    }
+
+    // 上层协议已启用
+    if (protocol_count) {
+        tpacket_filter_stmt(code, &n, BPF_LD | BPF_B | BPF_ABS, 14 + 9);
+        for (uint32_t i = 0; i < protocol_count; i++) {
+            tpacket_filter_jeq(code, &n, filter->protocol[i], l_accept,
+                               (i + 1 < protocol_count) ? n + 1 : l_reject);
+        }
+    }
+
+    tpacket_filter_stmt(code, &n, BPF_RET | BPF_K, TPACKET_FILTER_ACCEPT);
+    tpacket_filter_stmt(code, &n, BPF_RET | BPF_K, 0);
+
+    prog.len = (unsigned short)n;
+    prog.filter = code;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+}
+
+/**
+ * 读取网卡自启动以来收到的帧数，用于计算被内核过滤器丢弃的帧数
+ * @return 1 - 成功，0 - 出错
+ */
+static int tpacket_if_rx_packets(const char * if_name, uint64_t * packets) {
+    char path[64 + IF_NAMESIZE];
+    unsigned long long value;
+    FILE * file;
+    int ok;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/statistics/rx_packets", if_name);
+    file = fopen(path, "r");
+    if (file == (FILE *)0) {
+        return 0;
+    }
+    ok = fscanf(file, "%llu", &value) == 1;
+    fclose(file);
+
+    *packets = value;
+    return ok;
+}
+
+/**
+ * 打开 AF_PACKET 设备接口
+ * @param if_name 网卡名称，如 "veth1"、"tap0"
+ * @param mac_addr 协议栈使用的 mac
+ * @param poll_mode 非 0 时以非阻塞方式读取，配合 tpacket_device_wait 等待数据包；
+ *                  为 0 时读取会阻塞到有数据包为止
+ */
+tpacket_device_t * tpacket_device_open(const char * if_name, const uint8_t * mac_addr, uint8_t poll_mode) {
+    struct tpacket_req3 rx_req, tx_req;
+    struct packet_mreq mreq;
+    struct sockaddr_ll addr;
+    net_filter_t filter;
+    tpacket_device_t * dev;
+    int version = TPACKET_V3;
+    int ignore = 1;
+    int stamp_flags = SOF_TIMESTAMPING_SOFTWARE;
+    int if_index;
+
+    if_index = (int)if_nametoindex(if_name);
+    if (if_index == 0) {
+        fprintf(stderr, "tpacket_open: no net card named: %s\n", if_name);
+        return (tpacket_device_t *)0;
+    }
+
+    dev = (tpacket_device_t *)calloc(1, sizeof(tpacket_device_t));
+    if (dev == (tpacket_device_t *)0) {
+        return (tpacket_device_t *)0;
+    }
+
+    dev->poll_mode = poll_mode;
+    dev->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (dev->fd < 0) {
+        fprintf(stderr, "tpacket_open: create socket failed: %s\n", strerror(errno));
+        goto error_end;
+    }
+
+    // 协议栈给出过滤条件之前，先只按 MAC 过滤
+    memset(&filter, 0, sizeof(filter));
+    memcpy(filter.mac, mac_addr, sizeof(filter.mac));
+    if (tpacket_set_filter(dev->fd, &filter) < 0) {
+        fprintf(stderr, "tpacket_open: install filter failed: %s\n", strerror(errno));
+        goto error_end;
+    }
+
+    // 只接收输入，不要接收自己发出去的；老内核不支持时由过滤器兜底
+    setsockopt(dev->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+
+    // 只打开软件时间戳的回报，是否生成由每次提交时的控制消息决定，普通帧没有额外开销
+    if ((setsockopt(dev->fd, SOL_SOCKET, SO_TIMESTAMPING, &stamp_flags, sizeof(stamp_flags)) == 0)
+        && (spsc_ring_init(&dev->stamp_ring, TPACKET_STAMP_RING_SIZE, sizeof(uint64_t) + NET_FRAME_SLOT_SIZE) == 0)) {
+        dev->tx_stamping = 1;
+    }
+
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        fprintf(stderr, "tpacket_open: TPACKET_V3 not support: %s\n", strerror(errno));
+        goto error_end;
+    }
+
+    memset(&rx_req, 0, sizeof(rx_req));
+    rx_req.tp_block_size = TPACKET_RX_BLOCK_SIZE;
+    rx_req.tp_block_nr = TPACKET_RX_BLOCK_NR;
+    rx_req.tp_frame_size = TPACKET_RX_FRAME_SIZE;
+    rx_req.tp_frame_nr = (TPACKET_RX_BLOCK_SIZE / TPACKET_RX_FRAME_SIZE) * TPACKET_RX_BLOCK_NR;
+    rx_req.tp_retire_blk_tov = TPACKET_RX_BLOCK_TIMEOUT;
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_RX_RING, &rx_req, sizeof(rx_req)) < 0) {
+        fprintf(stderr, "tpacket_open: create rx ring failed: %s\n", strerror(errno));
+        goto error_end;
+    }
+
+    memset(&tx_req, 0, sizeof(tx_req));
+    tx_req.tp_block_size = TPACKET_TX_FRAME_SIZE * 16;
+    tx_req.tp_block_nr = TPACKET_TX_FRAME_NR / 16;
+    tx_req.tp_frame_size = TPACKET_TX_FRAME_SIZE;
+    tx_req.tp_frame_nr = TPACKET_TX_FRAME_NR;
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_TX_RING, &tx_req, sizeof(tx_req)) < 0) {
+        fprintf(stderr, "tpacket_open: create tx ring failed: %s\n", strerror(errno));
+        goto error_end;
+    }
+
+    dev->map_size = (size_t)TPACKET_RX_BLOCK_SIZE * TPACKET_RX_BLOCK_NR
+                  + (size_t)TPACKET_TX_FRAME_SIZE * TPACKET_TX_FRAME_NR;
+    dev->map = (uint8_t *)mmap(NULL, dev->map_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, dev->fd, 0);
+    if (dev->map == MAP_FAILED) {
+        fprintf(stderr, "tpacket_open: mmap ring failed: %s\n", strerror(errno));
+        dev->map = (uint8_t *)0;
+        goto error_end;
+    }
+    dev->rx_ring = dev->map;
+    dev->tx_ring = dev->map + (size_t)TPACKET_RX_BLOCK_SIZE * TPACKET_RX_BLOCK_NR;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = if_index;
+    if (bind(dev->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "tpacket_open: bind %s failed: %s\n", if_name, strerror(errno));
+        goto error_end;
+    }
+    snprintf(dev->if_name, sizeof(dev->if_name), "%s", if_name);
+    dev->if_rx_valid = tpacket_if_rx_packets(if_name, &dev->if_rx_base);
+
+    // 协议栈使用自己的 mac，需要网卡工作在混杂模式下
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = if_index;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(dev->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+        fprintf(stderr, "tpacket_open: set promisc failed: %s\n", strerror(errno));
+    }
+
+    return dev;
+
+error_end:
+    tpacket_device_close(dev);
+    return (tpacket_device_t *)0;
+}
+
+/**
+ * 关闭 AF_PACKET 接口
+ */
+void tpacket_device_close(tpacket_device_t * dev) {
+    if (dev == (tpacket_device_t *)0) {
+        return;
+    }
+
+    if (dev->map) {
+        munmap(dev->map, dev->map_size);
+    }
+    if (dev->fd >= 0) {
+        close(dev->fd);
+    }
+    spsc_ring_free(&dev->stamp_ring);
+    free(dev);
+}
+
+/**
+ * 向网络接口发送数据包：只拷贝到发送环中，调用 tpacket_device_flush 时才通知内核发送
+ * @return 发送的字节数，0 表示失败
+ */
+uint32_t tpacket_device_send(tpacket_device_t * dev, const uint8_t * buffer, uint32_t length) {
+    const uint32_t data_offset = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+    struct tpacket3_hdr * hdr;
+
+    if (length > TPACKET_TX_FRAME_SIZE - data_offset) {
+        fprintf(stderr, "tpacket send: pcaket size %d too large\n", length);
+        return 0;
+    }
+
+    hdr = (struct tpacket3_hdr *)(dev->tx_ring + (size_t)dev->tx_index * TPACKET_TX_FRAME_SIZE);
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+        // 发送环已满，先让内核把已有的帧发出去
+        dev->tx_pending = 0;
+        send(dev->fd, NULL, 0, 0);
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+            fprintf(stderr, "tpacket send: tx ring full\n");
+            return 0;
+        }
+    }
+
+    memcpy((uint8_t *)hdr + data_offset, buffer, length);
+    hdr->tp_len = length;
+    hdr->tp_snaplen = length;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+    dev->tx_index = (dev->tx_index + 1) % TPACKET_TX_FRAME_NR;
+    dev->tx_pending++;
+    return length;
+}
+
+/**
+ * 通知内核把发送环中所有待发送的帧一次发出去
+ * @param tx_timestamp 为 1 时要求内核为本次提交的帧生成软件发送时间戳，
+ *                     由 tpacket_device_tx_timestamp 取回
+ * @return 本次提交的帧数
+ */
+uint32_t tpacket_device_flush(tpacket_device_t * dev, uint8_t tx_timestamp) {
+    uint32_t count = dev->tx_pending;
+    union {
+        char buf[CMSG_SPACE(sizeof(uint32_t))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    ssize_t err;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    dev->tx_pending = 0;
+    memset(&msg, 0, sizeof(msg));
+    if (tx_timestamp && dev->tx_stamping) {
+        struct cmsghdr * cmsg;
+
+        memset(&control, 0, sizeof(control));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SO_TIMESTAMPING;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+        *(uint32_t *)CMSG_DATA(cmsg) = SOF_TIMESTAMPING_TX_SOFTWARE;
+    }
+
+    err = sendmsg(dev->fd, &msg, MSG_DONTWAIT);
+    if (err < 0 && errno != EAGAIN && errno != ENOBUFS) {
+        fprintf(stderr, "tpacket flush: send packet failed!:%s\n", strerror(errno));
+        return 0;
+    }
+
+    return count;
+}
+
+/**
+ * 从错误队列中读出一个软件发送时间戳：网卡驱动发出帧时内核把帧的副本连同时间戳放入错误队列
+ * @return 1 - 取到一个，0 - 队列已空
+ */
+static int tpacket_errqueue_recv(tpacket_device_t * dev, uint8_t * buffer, uint32_t * length, uint64_t * timestamp) {
+    char control[256];
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr * cmsg;
+    ssize_t size;
+
+    for (;;) {
+        iov.iov_base = buffer;
+        iov.iov_len = *length;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        size = recvmsg(dev->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+        if (size < 0) {
+            return 0;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SO_TIMESTAMPING)) {
+                const struct scm_timestamping * tss = (const struct scm_timestamping *)CMSG_DATA(cmsg);
+
+                // ts[0] 为软件时间戳，ts[2] 为网卡硬件时间戳
+                if (tss->ts[0].tv_sec || tss->ts[0].tv_nsec) {
+                    *timestamp = (uint64_t)tss->ts[0].tv_sec * 1000000000ULL + tss->ts[0].tv_nsec;
+                    *length = (uint32_t)size;
+                    return 1;
+                }
+            }
+        }
+        // 不带时间戳的错误消息直接丢弃
+    }
+}
+
+/**
+ * 把错误队列中的时间戳全部转存到时间戳环：队列不空时描述符一直报告 POLLERR，
+ * 不取走的话等待接收会立即返回。环满时时间戳被丢弃
+ */
+static void tpacket_errqueue_drain(tpacket_device_t * dev) {
+    uint8_t discard[64];
+    uint32_t length;
+    uint64_t timestamp;
+    int drained = 0;
+
+    for (;;) {
+        uint8_t * slot = dev->tx_stamping ? spsc_ring_reserve(&dev->stamp_ring) : (uint8_t *)0;
+
+        if (slot) {
+            length = dev->stamp_ring.slot_size - SPSC_SLOT_HEAD - sizeof(uint64_t);
+            if (!tpacket_errqueue_recv(dev, slot + sizeof(uint64_t), &length, &timestamp)) {
+                break;
+            }
+            memcpy(slot, &timestamp, sizeof(uint64_t));
+            spsc_ring_commit(&dev->stamp_ring, sizeof(uint64_t) + length);
+        } else {
+            length = sizeof(discard);
+            if (!tpacket_errqueue_recv(dev, discard, &length, &timestamp)) {
+                break;
+            }
+        }
+        drained++;
+    }
+
+    // 队列中没有时间戳时 POLLERR 来自套接字错误，读出后清除
+    if (!drained) {
+        int err;
+        socklen_t err_len = sizeof(err);
+
+        getsockopt(dev->fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+    }
+}
+
+/**
+ * 取出一个软件发送时间戳：先取等待接收时已转存的，再读错误队列
+ * @param buffer 存放已发出帧的缓冲区
+ * @param length 缓冲区大小，返回帧长度
+ * @param timestamp 帧离开网卡驱动的时间（ns）
+ * @return 1 - 取到一个，0 - 没有
+ */
+int tpacket_device_tx_timestamp(tpacket_device_t * dev, uint8_t * buffer, uint32_t * length, uint64_t * timestamp) {
+    if (!dev->tx_stamping) {
+        return 0;
+    }
+
+    if (spsc_ring_count(&dev->stamp_ring) > 0) {
+        uint32_t size;
+        const uint8_t * slot = spsc_ring_peek(&dev->stamp_ring, 0, &size);
+
+        size -= sizeof(uint64_t);
+        if (size > *length) {
+            size = *length;
+        }
+        memcpy(timestamp, slot, sizeof(uint64_t));
+        memcpy(buffer, slot + sizeof(uint64_t), size);
+        *length = size;
+        spsc_ring_pop(&dev->stamp_ring, 1);
+        return 1;
+    }
+
+    return tpacket_errqueue_recv(dev, buffer, length, timestamp);
+}
+
+/**
+ * 用户已处理完取出的帧：所在块已全部取完时立即归还给内核
+ */
+void tpacket_device_release(tpacket_device_t * dev) {
+    struct tpacket_block_desc * block;
+
+    if (!dev->rx_held || (dev->rx_left > 0)) {
+        return;
+    }
+
+    block = (struct tpacket_block_desc *)(dev->rx_ring + (size_t)dev->rx_block * TPACKET_RX_BLOCK_SIZE);
+    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+    dev->rx_held = 0;
+    dev->rx_block = (dev->rx_block + 1) % TPACKET_RX_BLOCK_NR;
+}
+
+/**
+ * 归还已取完的块，并检查下一块是否已由内核填好
+ * @return 1 - 有新块可读，0 - 没有数据
+ */
+static int tpacket_next_block(tpacket_device_t * dev) {
+    struct tpacket_block_desc * block;
+
+    while (dev->rx_left == 0) {
+        // 当前块已取完，归还给内核，切换到下一块
+        tpacket_device_release(dev);
+        block = (struct tpacket_block_desc *)(dev->rx_ring + (size_t)dev->rx_block * TPACKET_RX_BLOCK_SIZE);
+
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            return 0;
+        }
+
+        dev->rx_held = 1;
+        dev->rx_left = block->hdr.bh1.num_pkts;
+        dev->rx_frame = (struct tpacket3_hdr *)((uint8_t *)block + block->hdr.bh1.offset_to_first_pkt);
+    }
+
+    return 1;
+}
+
+/**
+ * 等待接收环中有帧可读：内核把块交给用户时描述符变为可读。
+ * 发送时间戳进入错误队列时也会唤醒，转存到时间戳环后，一直等待时接着等，否则提前返回
+ * @param timeout_ms 最长等待时间，-1 表示一直等待
+ * @return 1 - 有帧可读，0 - 超时或出错
+ */
+int tpacket_device_wait(tpacket_device_t * dev, int timeout_ms) {
+    struct pollfd pfd;
+
+    if (tpacket_next_block(dev)) {
+        return 1;
+    }
+
+    pfd.fd = dev->fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+        if (tpacket_next_block(dev)) {
+            return 1;
+        }
+        if (pfd.revents & POLLERR) {
+            tpacket_errqueue_drain(dev);
+        }
+        if (timeout_ms >= 0) {
+            return 0;
+        }
+    }
+}
+
+/**
+ * 从当前块中取出一帧
+ * @param timestamp 内核收到该帧的时间（ns）
+ * @param csum 校验和状态 TPACKET_CSUM_*，为 0 时不取
+ */
+static const uint8_t * tpacket_take_frame(tpacket_device_t * dev, uint32_t * length, uint64_t * timestamp,
+                                          uint8_t * csum) {
+    struct tpacket3_hdr * hdr = dev->rx_frame;
+
+    dev->rx_left--;
+    dev->rx_frame = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+
+    // TPACKET_V3 的帧时间戳默认为纳秒精度
+    *timestamp = (uint64_t)hdr->tp_sec * 1000000000ULL + hdr->tp_nsec;
+    *length = hdr->tp_snaplen;
+    if (csum) {
+        // 网卡或内核已验证过校验和；或帧由本机发出、校验和留给网卡计算，还没有填好
+        *csum = ((hdr->tp_status & TP_STATUS_CSUM_VALID) ? TPACKET_CSUM_VALID : 0)
+              | ((hdr->tp_status & TP_STATUS_CSUMNOTREADY) ? TPACKET_CSUM_PARTIAL : 0);
+    }
+    return (const uint8_t *)hdr + hdr->tp_mac;
+}
+
+/**
+ * 读取前检查是否有帧：非阻塞方式下立即返回，否则一直等到有帧可读
+ * @return 1 - 有帧可读，0 - 没有数据或出错
+ */
+static int tpacket_rx_ready(tpacket_device_t * dev) {
+    if (tpacket_next_block(dev)) {
+        return 1;
+    }
+    return dev->poll_mode ? 0 : tpacket_device_wait(dev, -1);
+}
+
+/**
+ * 从网络接口读取数据包，不拷贝，直接返回接收环中帧的地址
+ * 上一次返回的帧在本次调用时失效，所在的块如已取完则归还给内核
+ * @param length 帧长度
+ * @param timestamp 内核收到该帧的时间（ns）
+ * @param csum 校验和状态 TPACKET_CSUM_*，为 0 时不取
+ * @return 帧起始地址，没有数据包时返回 0
+ */
+const uint8_t * tpacket_device_read(tpacket_device_t * dev, uint32_t * length, uint64_t * timestamp, uint8_t * csum) {
+    if (!tpacket_rx_ready(dev)) {
+        return (const uint8_t *)0;
+    }
+
+    return tpacket_take_frame(dev, length, timestamp, csum);
+}
+
+/**
+ * 批量读取数据包，不拷贝。一批帧只取自同一个块，整批在下一次读取之前有效
+ * @param frames 各帧起始地址
+ * @param lengths 各帧长度
+ * @param timestamps 各帧的内核接收时间（ns）
+ * @param csums 各帧的校验和状态 TPACKET_CSUM_*，为 0 时不取
+ * @param max 最多读取的帧数
+ * @return 读到的帧数
+ */
+uint32_t tpacket_device_read_batch(tpacket_device_t * dev, const uint8_t ** frames, uint32_t * lengths,
+                                   uint64_t * timestamps, uint8_t * csums, uint32_t max) {
+    uint32_t count = 0;
+
+    if (!tpacket_rx_ready(dev)) {
+        return 0;
+    }
+
+    while ((count < max) && (dev->rx_left > 0)) {
+        frames[count] = tpacket_take_frame(dev, &lengths[count], &timestamps[count], csums ? &csums[count] : 0);
+        count++;
+    }
+
+    return count;
+}
+
+/**
+ * 读取内核的接收统计，自打开以来累计
+ * @param packets 内核收到并通过过滤器的帧数
+ * @param drops 接收环满被内核丢弃的帧数
+ * @param filtered 网卡收到、被过滤器丢弃的帧数，读不到网卡的接收计数时为 0
+ * @return 0 - 成功，-1 - 出错
+ */
+int tpacket_device_stats(tpacket_device_t * dev, uint32_t * packets, uint32_t * drops, uint32_t * filtered) {
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof(stats);
+    uint64_t if_rx;
+
+    if (getsockopt(dev->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0) {
+        return -1;
+    }
+
+    // tp_packets 中包含了被丢弃的帧
+    dev->stat_packets += stats.tp_packets;
+    dev->stat_drops += stats.tp_drops;
+    *packets = dev->stat_packets;
+    *drops = dev->stat_drops;
+
+    // 网卡收到的帧要么通过过滤器计入 tp_packets，要么被过滤器丢弃
+    *filtered = 0;
+    if (dev->if_rx_valid && tpacket_if_rx_packets(dev->if_name, &if_rx)
+        && (if_rx - dev->if_rx_base > dev->stat_packets)) {
+        *filtered = (uint32_t)(if_rx - dev->if_rx_base - dev->stat_packets);
+    }
+    return 0;
+}
+
+/**
+ * 按协议栈给出的条件重新安装过滤器，地址改变后调用
+ * @return 0 - 成功，-1 - 出错
+ */
+int tpacket_device_set_filter(tpacket_device_t * dev, const net_filter_t * filter) {
+    if (tpacket_set_filter(dev->fd, filter) < 0) {
+        fprintf(stderr, "tpacket_set_filter: install filter failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 接收线程的参数
+ */
+typedef struct _tpacket_rx_t {
+    tpacket_device_t * dev;
+    irq_handler_t handler;
+    void * arg;
+} tpacket_rx_t;
+
+static void * tpacket_rx_thread(void * param) {
+    tpacket_rx_t * rx = (tpacket_rx_t *)param;
+    tpacket_device_t * dev = rx->dev;
+
+    for (;;) {
+        const uint8_t * frames[TPACKET_RX_THREAD_BATCH];
+        uint32_t lengths[TPACKET_RX_THREAD_BATCH];
+        uint64_t timestamps[TPACKET_RX_THREAD_BATCH];
+        uint32_t count;
+
+        if (!tpacket_device_wait(dev, -1)) {
+            continue;
+        }
+
+        count = tpacket_device_read_batch(dev, frames, lengths, timestamps, 0, TPACKET_RX_THREAD_BATCH);
+        for (uint32_t i = 0; i < count; i++) {
+            rx->handler(rx->arg, 1, frames[i], lengths[i]);
+        }
+        tpacket_device_release(dev);
+    }
+    return NULL;
+}
+
+/**
+ * 启动接收线程：接收环中每有一帧调用一次 handler，线程随进程退出。
+ * 启动后接收环归接收线程所有，不能再调用 tpacket_device_read*；发送仍在调用者的线程中进行
+ * @return 0 - 成功，其它失败
+ */
+int tpacket_device_start_rx(tpacket_device_t * dev, irq_handler_t handler, void * arg) {
+    tpacket_rx_t * rx = (tpacket_rx_t *)malloc(sizeof(tpacket_rx_t));
+    pthread_t thread;
+
+    if (rx == (tpacket_rx_t *)0) {
+        return -1;
+    }
+
+    rx->dev = dev;
+    rx->handler = handler;
+    rx->arg = arg;
+    if (pthread_create(&thread, NULL, tpacket_rx_thread, rx) != 0) {
+        fprintf(stderr, "tpacket_start_rx: create rx thread failed\n");
+        free(rx);
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
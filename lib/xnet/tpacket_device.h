@@ -0,0 +1,43 @@
+#ifndef TPACKET_DRIVER_H
+#define TPACKET_DRIVER_H
+
+#include <stdint.h>
+#include "net_irq.h"
+#include "net_filter.h"
+#include "net_mtu.h"
+
+// 接收环：块大小与块数量，一个块内可以容纳多个帧
+#define TPACKET_RX_BLOCK_SIZE       (1 << 16)
+#define TPACKET_RX_BLOCK_NR         64
+#define TPACKET_RX_BLOCK_TIMEOUT    1           // 块未填满时，最多等待多少毫秒就交给用户
+#define TPACKET_RX_FRAME_SIZE       NET_FRAME_SLOT_SIZE
+#define TPACKET_RX_THREAD_BATCH     64          // 接收线程一次从环中取出的最多帧数
+
+// 发送环：每帧固定大小，16 帧一块，按 2KB 取整的帧大小保证块大小是页的整数倍
+#define TPACKET_TX_FRAME_SIZE       NET_FRAME_SLOT_SIZE
+#define TPACKET_TX_FRAME_NR         256
+
+// 等待接收时从错误队列转存的发送时间戳数量（2 的幂），满了之后新的时间戳被丢弃
+#define TPACKET_STAMP_RING_SIZE     16
+
+// 接收帧的校验和状态
+#define TPACKET_CSUM_VALID          (1 << 0)    // 网卡或内核已验证过校验和
+#define TPACKET_CSUM_PARTIAL        (1 << 1)    // 本机发出的帧，校验和留给网卡计算，尚未填好
+
+typedef struct _tpacket_device_t tpacket_device_t;
+
+tpacket_device_t * tpacket_device_open(const char * if_name, const uint8_t * mac_addr, uint8_t poll_mode);
+void tpacket_device_close(tpacket_device_t * dev);
+uint32_t tpacket_device_send(tpacket_device_t * dev, const uint8_t * buffer, uint32_t length);
+uint32_t tpacket_device_flush(tpacket_device_t * dev, uint8_t tx_timestamp);
+const uint8_t * tpacket_device_read(tpacket_device_t * dev, uint32_t * length, uint64_t * timestamp, uint8_t * csum);
+uint32_t tpacket_device_read_batch(tpacket_device_t * dev, const uint8_t ** frames, uint32_t * lengths,
+                                  uint64_t * timestamps, uint8_t * csums, uint32_t max);
+void tpacket_device_release(tpacket_device_t * dev);
+int tpacket_device_wait(tpacket_device_t * dev, int timeout_ms);
+int tpacket_device_tx_timestamp(tpacket_device_t * dev, uint8_t * buffer, uint32_t * length, uint64_t * timestamp);
+int tpacket_device_stats(tpacket_device_t * dev, uint32_t * packets, uint32_t * drops, uint32_t * filtered);
+int tpacket_device_set_filter(tpacket_device_t * dev, const net_filter_t * filter);
+int tpacket_device_start_rx(tpacket_device_t * dev, irq_handler_t handler, void * arg);
+
+#endif //TPACKET_DRIVER_H
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include "spsc_ring.h"
+#include "vwire_device.h"
+
+/**
+ * 进程内的虚拟线缆驱动
+ * 同名的线缆第一次打开得到 0 号端，第二次打开得到 1 号端，两端通过一对无锁帧环相连。
+ * 收发都在用户态内存中完成，没有系统调用，用于单独测量协议栈本身的开销
+ */
+struct _vwire_end_t {
+    spsc_ring_t * tx;                   // 本端发出，对端接收
+    spsc_ring_t * rx;                   // 对端发出，本端接收
+    uint8_t used;
+};
+
+typedef struct _vwire_t {
+    char name[32];
+    uint8_t opened;                     // 已打开的端数
+    spsc_ring_t ring[2];                // ring[i]: i 号端发往对端
+    vwire_end_t end[2];
+} vwire_t;
+
+static vwire_t wires[VWIRE_MAX_WIRES];
+
+static vwire_t * vwire_find(const char * name) {
+    for (int i = 0; i < VWIRE_MAX_WIRES; i++) {
+        if (wires[i].opened && (strcmp(wires[i].name, name) == 0)) {
+            return &wires[i];
+        }
+    }
+    return (vwire_t *)0;
+}
+
+/**
+ * 打开虚拟线缆的一端，线缆不存在时创建
+ * @param name 线缆名称，如 "vwire0"
+ * @return 线缆端，两端都已被打开时返回 0
+ */
+vwire_end_t * vwire_device_open(const char * name) {
+    vwire_t * wire = vwire_find(name);
+    vwire_end_t * end;
+
+    if (wire == (vwire_t *)0) {
+        for (int i = 0; i < VWIRE_MAX_WIRES; i++) {
+            if (!wires[i].opened) {
+                wire = &wires[i];
+                break;
+            }
+        }
+        if (wire == (vwire_t *)0) {
+            fprintf(stderr, "vwire_open: too many wires\n");
+            return (vwire_end_t *)0;
+        }
+
+        memset(wire, 0, sizeof(vwire_t));
+        strncpy(wire->name, name, sizeof(wire->name) - 1);
+        if ((spsc_ring_init(&wire->ring[0], VWIRE_RING_SIZE, VWIRE_FRAME_SIZE) < 0)
+            || (spsc_ring_init(&wire->ring[1], VWIRE_RING_SIZE, VWIRE_FRAME_SIZE) < 0)) {
+            fprintf(stderr, "vwire_open: alloc ring failed\n");
+            spsc_ring_free(&wire->ring[0]);
+            spsc_ring_free(&wire->ring[1]);
+            return (vwire_end_t *)0;
+        }
+        wire->end[0].tx = &wire->ring[0];
+        wire->end[0].rx = &wire->ring[1];
+        wire->end[1].tx = &wire->ring[1];
+        wire->end[1].rx = &wire->ring[0];
+    } else if (wire->opened >= 2) {
+        fprintf(stderr, "vwire_open: both ends of %s already opened\n", name);
+        return (vwire_end_t *)0;
+    }
+
+    end = &wire->end[wire->end[0].used ? 1 : 0];
+    end->used = 1;
+    wire->opened++;
+    return end;
+}
+
+/**
+ * 关闭线缆的一端，两端都关闭后释放线缆
+ */
+void vwire_device_close(vwire_end_t * end) {
+    for (int i = 0; i < VWIRE_MAX_WIRES; i++) {
+        vwire_t * wire = &wires[i];
+
+        if (wire->opened && ((end == &wire->end[0]) || (end == &wire->end[1]))) {
+            end->used = 0;
+            if (--wire->opened == 0) {
+                spsc_ring_free(&wire->ring[0]);
+                spsc_ring_free(&wire->ring[1]);
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * 向对端发送一帧
+ * @return 发送的字节数，0 表示环已满或帧过长
+ */
+uint32_t vwire_device_send(vwire_end_t * end, const uint8_t * buffer, uint32_t length) {
+    return spsc_ring_push(end->tx, buffer, length) == 0 ? length : 0;
+}
+
+/**
+ * 批量读取对端发来的帧，不拷贝，帧在 vwire_device_release 之前有效，帧中的 IP 头按 4 字节对齐
+ * @return 读到的帧数
+ */
+uint32_t vwire_device_read_batch(vwire_end_t * end, const uint8_t ** frames, uint32_t * lengths, uint32_t max) {
+    uint32_t count = spsc_ring_count(end->rx);
+
+    if (count > max) {
+        count = max;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        frames[i] = spsc_ring_peek(end->rx, i, &lengths[i]);
+    }
+    return count;
+}
+
+/**
+ * 归还已处理完的 count 帧
+ */
+void vwire_device_release(vwire_end_t * end, uint32_t count) {
+    spsc_ring_pop(end->rx, count);
+}
@@ -0,0 +1,20 @@
+#ifndef VWIRE_DRIVER_H
+#define VWIRE_DRIVER_H
+
+#include <stdint.h>
+#include "net_mtu.h"
+
+// 虚拟线缆：每个方向一个帧环
+#define VWIRE_RING_SIZE             1024        // 每个方向的槽数量，2 的幂
+#define VWIRE_FRAME_SIZE            (XNET_CFG_MTU + 36)     // 单帧最大长度，MTU 为 1500 时为 1536
+#define VWIRE_MAX_WIRES             4           // 同时存在的线缆数量
+
+typedef struct _vwire_end_t vwire_end_t;
+
+vwire_end_t * vwire_device_open(const char * name);
+void vwire_device_close(vwire_end_t * end);
+uint32_t vwire_device_send(vwire_end_t * end, const uint8_t * buffer, uint32_t length);
+uint32_t vwire_device_read_batch(vwire_end_t * end, const uint8_t ** frames, uint32_t * lengths, uint32_t max);
+void vwire_device_release(vwire_end_t * end, uint32_t count);
+
+#endif //VWIRE_DRIVER_H
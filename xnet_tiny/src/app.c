@@ -1,8 +1,31 @@
 ﻿#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
 #include <windows.h>
 #include <conio.h>
+#else
+#include <unistd.h>
+#include <sys/select.h>
+
+#define Sleep(ms)       usleep((ms) * 1000)
+
+// 检查终端是否有输入，不阻塞
+static int _kbhit(void) {
+    struct timeval tv = {0, 0};
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(STDIN_FILENO, &fds);
+    return select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv) > 0;
+}
+
+static int _getch(void) {
+    return getchar();
+}
+#endif
 #include "xnet_tiny.h"
+#include "xnet_capture.h"
 
 #define MODE_IDLE       0
 #define MODE_PING       1
@@ -10,24 +33,96 @@
 #define MODE_BANDWIDTH  3
 #define MODE_JITTER     4
 
-// 非阻塞等待最近一次 RTT，超时返回 -1
-static int wait_for_reply(int timeout_ms) {
-    int elapsed = 0;
-    while (elapsed < timeout_ms) {
-        xnet_poll();
-        int rtt = xicmp_get_last_rtt();
-        if (rtt >= 0) {
-            return rtt;
+// XNET_WAIT_NONE 模式下每轮循环的休眠时间
+#define LOOP_DELAY_MS   10
+
+// 空闲时的等待方式，由环境变量 XNET_WAIT 选择：block（默认）、busy、none
+static xnet_wait_mode_t wait_mode = XNET_WAIT_BLOCK;
+
+#if XNET_CFG_PING
+// 等待最近一次 RTT（ms，带小数），超时返回 -1
+static double wait_for_reply(int timeout_ms) {
+    uint32_t start = xnet_now_ms();
+    while ((int)(xnet_now_ms() - start) < timeout_ms) {
+        xnet_poll();        // block/busy 模式下在 xnet_poll() 内等待回复
+        int64_t rtt_ns = xicmp_get_last_rtt_ns();
+        if (rtt_ns >= 0) {
+            return (double)rtt_ns / 1000000.0;
+        }
+        if (wait_mode == XNET_WAIT_NONE) {
+            Sleep(LOOP_DELAY_MS);
         }
-        Sleep(10);
-        elapsed += 10;
     }
     return -1;
 }
+#else
+// 只编译了 ARP 与 ping 的应答：没有菜单，一直应答直到按 ESC
+static int run_responder(void) {
+    printf("=== XNET Tiny (ARP/ping responder) ===\n");
+    printf("Press ESC to exit.\n\n");
+
+    while (1) {
+        xnet_poll();
+
+        if (_kbhit()) {
+            int c = _getch();
+            if (c == 27) break; // ESC 退出
+        }
+
+        if (wait_mode == XNET_WAIT_NONE) {
+            Sleep(LOOP_DELAY_MS);
+        }
+    }
+    return 0;
+}
+#endif
 
 int main (void) {
+    // XNET_CAPTURE=文件名 时抓取所有收发的帧，扩展名为 .pcapng 时写 pcapng 格式
+    const char * capture = getenv("XNET_CAPTURE");
+    if (capture) {
+        xnet_capture_open(capture, strstr(capture, ".pcapng") ? XNET_CAPTURE_PCAPNG : XNET_CAPTURE_PCAP);
+    }
+
+    // XNET_WAIT=busy 时可用 XNET_CPU 把轮询线程绑定到指定 CPU
+    const char * wait = getenv("XNET_WAIT");
+    const char * cpu = getenv("XNET_CPU");
+    if (wait && (strcmp(wait, "busy") == 0)) {
+        wait_mode = XNET_WAIT_BUSY;
+    } else if (wait && (strcmp(wait, "none") == 0)) {
+        wait_mode = XNET_WAIT_NONE;
+    }
+    if (cpu && (xnet_set_cpu(atoi(cpu)) != XNET_ERR_OK)) {
+        printf("Bind to CPU %s failed.\n", cpu);
+    }
+    xnet_set_wait_mode(wait_mode, XNET_TICK_MS);   // 程序自身的定时器都是 tick 的整数倍
+
+    // XNET_MTU=9000 时使用 jumbo 帧，不能超过编译时的上限 XNET_CFG_MTU
+    const char * mtu = getenv("XNET_MTU");
+    if (mtu && (xnet_set_mtu((uint16_t)atoi(mtu)) != XNET_ERR_OK)) {
+        printf("MTU %s out of range (68-%d).\n", mtu, XNET_CFG_MTU);
+    }
+
+    // XNET_RX=irq 时由驱动线程收帧，收到即唤醒协议栈，不必等到下一次轮询
+    const char * rx = getenv("XNET_RX");
+    if (rx && (strcmp(rx, "irq") == 0)) {
+        xnet_driver_set_rx_mode(XNET_RX_IRQ);
+    }
+
     xnet_init();
 
+    // XNET_LOCAL_IP=a.b.c.d 时更换协议栈的 IP，驱动的接收过滤器随之重新生成
+    const char * local_ip = getenv("XNET_LOCAL_IP");
+    uint8_t netif_ip[4];
+    if (local_ip && (sscanf(local_ip, "%hhu.%hhu.%hhu.%hhu",
+                            &netif_ip[0], &netif_ip[1], &netif_ip[2], &netif_ip[3]) == 4)) {
+        xnet_set_ip(netif_ip);
+    }
+
+#if !XNET_CFG_PING
+    return run_responder();
+#else
+
     uint8_t dest_ip[4] = {0};
     char ip_str[32] = {0};
     int mode = MODE_IDLE;
@@ -50,6 +145,12 @@ int main (void) {
     if (choice == 5) {
         return 0;
     }
+#if !XNET_CFG_TRACEROUTE
+    if (choice == MODE_TRACEROUTE) {
+        printf("Traceroute not built in (XNET_CFG_TRACEROUTE).\n");
+        return 0;
+    }
+#endif
 
     printf("Enter Target IP (e.g. 192.168.232.128): ");
     if (scanf("%31s", ip_str) != 1) {
@@ -63,31 +164,42 @@ int main (void) {
     }
 
     mode = choice; // 映射菜单选择
+#if XNET_CFG_TRACEROUTE
     if (mode == MODE_TRACEROUTE) {
         xicmp_traceroute_reset();
     }
-
-    // 带宽/抖动测量专用变量
-    int bw_sizes[] = {64, 256, 512, 1024};
-    double bw_results[4] = {0};
+#endif
+
+    // 带宽/抖动测量专用变量：负载从 64 字节起逐级增大，最后一级为一个 MTU 能容纳的最大负载
+    static const int bw_steps[] = {64, 256, 512, 1024, 2048, 4096, 8192};
+    const int bw_max = xnet_get_mtu() - (int)sizeof(xip_hdr_t) - (int)sizeof(xicmp_hdr_t);
+    int bw_sizes[sizeof(bw_steps) / sizeof(bw_steps[0]) + 1];
+    double bw_results[sizeof(bw_steps) / sizeof(bw_steps[0]) + 1] = {0};
+    int bw_count = 0;
     int bw_stage = 0;
+    for (int i = 0; (i < (int)(sizeof(bw_steps) / sizeof(bw_steps[0]))) && (bw_steps[i] < bw_max); i++) {
+        bw_sizes[bw_count++] = bw_steps[i];
+    }
+    bw_sizes[bw_count++] = bw_max;
 
     int jitter_count = 0;
     const int jitter_max_count = 20;
     int jitter_seqs[20] = {0};
-    int jitter_rtts[20] = {0};
+    double jitter_rtts[20] = {0};
     double jitter_vals[20] = {0};
-    int last_jitter_rtt = -1;
+    double last_jitter_rtt = -1;
     double total_jitter = 0;
     int valid_jitter_samples = 0;
 
-    // 通用计时器（毫秒）
-    const int LOOP_DELAY_MS = 10;
+    // 通用计时器（毫秒），按实际流逝的时间累加
+    uint32_t last_loop_ms = xnet_now_ms();
     int ping_timer_ms = 0;
+#if XNET_CFG_TRACEROUTE
     int traceroute_timer_ms = 0;
     int traceroute_wait_ms = 0;
     uint8_t traceroute_ttl = 1;
     const uint8_t traceroute_max_hops = 30;
+#endif
     int jitter_timer_ms = 0;
 
     printf("\nRunning Mode %d on %d.%d.%d.%d...\n", mode,
@@ -97,6 +209,10 @@ int main (void) {
     while (1) {
         xnet_poll();
 
+        uint32_t now_ms = xnet_now_ms();
+        int loop_ms = (int)(now_ms - last_loop_ms);
+        last_loop_ms = now_ms;
+
         if (_kbhit()) {
             int c = _getch();
             if (c == 27) break; // ESC 退出
@@ -104,7 +220,7 @@ int main (void) {
 
         switch (mode) {
             case MODE_PING:
-                ping_timer_ms += LOOP_DELAY_MS;
+                ping_timer_ms += loop_ms;
                 if (ping_timer_ms >= 1000) { // 每秒一次
                     ping_timer_ms = 0;
                     seq++;
@@ -117,8 +233,9 @@ int main (void) {
                 }
                 break;
 
+#if XNET_CFG_TRACEROUTE
             case MODE_TRACEROUTE:
-                traceroute_timer_ms += LOOP_DELAY_MS;
+                traceroute_timer_ms += loop_ms;
                 if (traceroute_timer_ms >= 100) { // 100ms 级别的状态机
                     traceroute_timer_ms = 0;
 
@@ -161,21 +278,22 @@ int main (void) {
                     }
                 }
                 break;
+#endif
 
             case MODE_BANDWIDTH:
-                if (bw_stage < (int)(sizeof(bw_sizes) / sizeof(bw_sizes[0]))) {
+                if (bw_stage < bw_count) {
                     int size = bw_sizes[bw_stage];
                     seq++;
 
                     xicmp_get_last_rtt(); // 清理旧值
                     int res = xicmp_ping(dest_ip, 2000, seq, (uint16_t)size);
                     if (res == 0) {
-                        int rtt = wait_for_reply(2000);
+                        double rtt = wait_for_reply(2000);
 
                         if (rtt > 0) {
-                            double kbps = (double)(size * 8) / (double)rtt;
+                            double kbps = (double)(size * 8) / rtt;
                             bw_results[bw_stage] = kbps;
-                            printf("Payload %4d bytes: RTT=%d ms, Bandwidth=~%.2f kbps\n",
+                            printf("Payload %4d bytes: RTT=%.3f ms, Bandwidth=~%.2f kbps\n",
                                    size, rtt, kbps);
                         } else {
                             printf("Payload %4d bytes: Request Timed Out.\n", size);
@@ -192,8 +310,15 @@ int main (void) {
                     FILE *fp = fopen("plot_bw.py", "w");
                     if (fp) {
                         fprintf(fp, "import matplotlib.pyplot as plt\n");
-                        fprintf(fp, "sizes = ['64', '256', '512', '1024']\n");
-                        fprintf(fp, "kbps = [%.2f, %.2f, %.2f, %.2f]\n", bw_results[0], bw_results[1], bw_results[2], bw_results[3]);
+                        fprintf(fp, "sizes = [");
+                        for (int i = 0; i < bw_count; i++) {
+                            fprintf(fp, "%s'%d'", i ? ", " : "", bw_sizes[i]);
+                        }
+                        fprintf(fp, "]\nkbps = [");
+                        for (int i = 0; i < bw_count; i++) {
+                            fprintf(fp, "%s%.2f", i ? ", " : "", bw_results[i]);
+                        }
+                        fprintf(fp, "]\n");
                         fprintf(fp, "plt.figure(figsize=(10, 6))\n");
                         fprintf(fp, "plt.bar(sizes, kbps, color='skyblue', edgecolor='black')\n");
                         fprintf(fp, "plt.title('ICMP Bandwidth Estimation')\n");
@@ -213,7 +338,7 @@ int main (void) {
                 break;
 
             case MODE_JITTER:
-                jitter_timer_ms += LOOP_DELAY_MS;
+                jitter_timer_ms += loop_ms;
                 if (jitter_timer_ms >= 500) { // 每 0.5 秒发一次
                     jitter_timer_ms = 0;
 
@@ -223,21 +348,21 @@ int main (void) {
                         xicmp_get_last_rtt(); // 清理旧值
                         xicmp_ping(dest_ip, 3000, seq, 64);
 
-                        int rtt = wait_for_reply(1000);
+                        double rtt = wait_for_reply(1000);
                         jitter_seqs[jitter_count] = jitter_count + 1;
                         if (rtt >= 0) {
                             jitter_rtts[jitter_count] = rtt;
-                            if (last_jitter_rtt != -1) {
-                                int diff = abs(rtt - last_jitter_rtt);
+                            if (last_jitter_rtt >= 0) {
+                                double diff = (rtt > last_jitter_rtt) ? (rtt - last_jitter_rtt) : (last_jitter_rtt - rtt);
                                 total_jitter += diff;
                                 valid_jitter_samples++;
                                 double avg_jitter = total_jitter / valid_jitter_samples;
 
-                                printf("Seq=%d RTT=%d ms | Diff=%d ms | Avg Jitter=%.2f ms\n",
+                                printf("Seq=%d RTT=%.3f ms | Diff=%.3f ms | Avg Jitter=%.3f ms\n",
                                        jitter_count + 1, rtt, diff, avg_jitter);
-                                jitter_vals[jitter_count] = (double)diff;
+                                jitter_vals[jitter_count] = diff;
                             } else {
-                                printf("Seq=%d RTT=%d ms (First packet)\n",
+                                printf("Seq=%d RTT=%.3f ms (First packet)\n",
                                        jitter_count + 1, rtt);
                                 jitter_vals[jitter_count] = 0.0;
                             }
@@ -260,11 +385,11 @@ int main (void) {
                             fprintf(fp, "]\n");
                             
                             fprintf(fp, "rtts = [");
-                            for(int i=0; i<jitter_count; i++) fprintf(fp, "%d,", jitter_rtts[i]);
+                            for(int i=0; i<jitter_count; i++) fprintf(fp, "%.3f,", jitter_rtts[i]);
                             fprintf(fp, "]\n");
                             
                             fprintf(fp, "jitters = [");
-                            for(int i=0; i<jitter_count; i++) fprintf(fp, "%.2f,", jitter_vals[i]);
+                            for(int i=0; i<jitter_count; i++) fprintf(fp, "%.3f,", jitter_vals[i]);
                             fprintf(fp, "]\n");
 
                             fprintf(fp, "plt.figure(figsize=(10, 8))\n");
@@ -304,8 +429,12 @@ int main (void) {
                 break;
         }
 
-        Sleep(LOOP_DELAY_MS);
+        xnet_flush();       // 本轮发出的探测包立即提交，不等下一次 poll
+        if (wait_mode == XNET_WAIT_NONE) {
+            Sleep(LOOP_DELAY_MS);
+        }
     }
 
     return 0;
+#endif
 }
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+#include "xnet_tiny.h"
+#include "xnet_capture.h"
+#if defined(NET_DRIVER_VWIRE)
+#include "vwire_device.h"
+#endif
+
+/**
+ * 收发吞吐量测试（pps）
+ * 用法：xnet_bench rx|tx|wire|replay [秒数] [wire 模式下的 ICMP 负载长度]
+ *   rx - 不停轮询协议栈，统计每秒收到的帧数与回复的帧数。由对端灌包，如：
+ *        ip link add veth0 type veth peer name veth1
+ *        ip addr add 192.168.75.1/24 dev veth0 && ip link set veth0 up && ip link set veth1 up
+ *        XNET_IF=veth1 ./xnet_bench rx 10  &  ping -f 192.168.75.200
+ *   tx - 以最快速度经驱动发送最小长度的广播帧，统计每秒发送的帧数
+ * 分别用 XNET_DRIVER=pcap、tpacket、tap 运行，比较各驱动的结果
+ * tap 驱动下由程序创建 tap0，启动后在主机侧配置 192.168.75.1/24 并启用即可
+ *   wire - 使用 vwire 驱动，需编译进 vwire。测试程序接在虚拟线缆的另一端，成批注入 Echo Request，
+ *        统计 xnet_poll() 内每帧的平均耗时（ns）与协议栈的 pps 上限，不受网卡和内核的影响。
+ *        协议栈的调试输出会拖慢结果，可将 stdout 重定向到 /dev/null，结果输出在 stderr
+ *   replay - 使用 savefile 驱动，需编译进 savefile。将 XNET_PCAP_IN 指定的抓包文件回放给协议栈直到读完，
+ *        统计有数据包的每次 xnet_poll() 中每帧的平均与最大耗时（ns）及整体 pps，秒数参数不起作用。
+ *        协议栈的回复保存在 XNET_PCAP_OUT 中，极速模式下同一输入的结果可逐次比较
+ */
+
+#define BENCH_NS_PER_SEC    1000000000ULL
+
+static uint64_t bench_now_ns(void) {
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * BENCH_NS_PER_SEC
+         + (uint64_t)(count.QuadPart % freq.QuadPart) * BENCH_NS_PER_SEC / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * BENCH_NS_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+static void bench_tx_one(void) {
+    xnet_packet_t * packet = xnet_alloc_for_send(60);
+
+    if (packet == (xnet_packet_t *)0) {
+        return;
+    }
+    memset(packet->data, 0xFF, 6);                  // 广播
+    memset(packet->data + 6, 0x00, 54);
+    packet->data[12] = 0x88;                        // 本地实验用的以太网类型
+    packet->data[13] = 0xB5;
+    xnet_driver_send(packet);
+    xnet_free(packet);
+}
+
+#if defined(NET_DRIVER_VWIRE)
+// 对端的地址；协议栈一侧与 port_vwire.c 和 arp_init 中的配置一致
+static const uint8_t peer_mac[XNET_MAC_ADDR_SIZE] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t peer_ip[XNET_IP_ADDR_SIZE] = {192, 168, 75, 1};
+static const uint8_t stack_mac[XNET_MAC_ADDR_SIZE] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+static const uint8_t stack_ip[XNET_IP_ADDR_SIZE] = {192, 168, 75, 200};
+
+static uint16_t bench_checksum(const void * buf, uint16_t len) {
+    const uint8_t * data = (const uint8_t *)buf;
+    uint32_t sum = 0;
+
+    for (; len > 1; len -= 2, data += 2) {
+        sum += (uint32_t)data[0] | ((uint32_t)data[1] << 8);
+    }
+    if (len) {
+        sum += *data;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static void bench_fill_ether(uint8_t * frame, uint16_t protocol) {
+    xether_hdr_t * ether = (xether_hdr_t *)frame;
+
+    memcpy(ether->dest, stack_mac, XNET_MAC_ADDR_SIZE);
+    memcpy(ether->src, peer_mac, XNET_MAC_ADDR_SIZE);
+    ether->protocol = (uint16_t)((protocol >> 8) | (protocol << 8));
+}
+
+/**
+ * 构造对端发出的 ARP 应答，让协议栈学到对端的 MAC
+ */
+static uint16_t bench_build_arp_reply(uint8_t * frame) {
+    xarp_packet_t * arp = (xarp_packet_t *)(frame + sizeof(xether_hdr_t));
+
+    memset(frame, 0, 60);
+    bench_fill_ether(frame, XNET_PROTOCOL_ARP);
+    arp->hw_type = 0x0100;
+    arp->proto_type = 0x0008;
+    arp->hw_len = XNET_MAC_ADDR_SIZE;
+    arp->proto_len = XNET_IP_ADDR_SIZE;
+    arp->opcode = 0x0200;
+    memcpy(arp->sender_mac, peer_mac, XNET_MAC_ADDR_SIZE);
+    memcpy(arp->sender_ip, peer_ip, XNET_IP_ADDR_SIZE);
+    memcpy(arp->target_mac, stack_mac, XNET_MAC_ADDR_SIZE);
+    memcpy(arp->target_ip, stack_ip, XNET_IP_ADDR_SIZE);
+    return 60;
+}
+
+/**
+ * 构造对端发出的 Echo Request
+ */
+static uint16_t bench_build_echo(uint8_t * frame, uint16_t payload) {
+    xip_hdr_t * ip = (xip_hdr_t *)(frame + sizeof(xether_hdr_t));
+    xicmp_hdr_t * icmp = (xicmp_hdr_t *)(ip + 1);
+    uint16_t icmp_len = (uint16_t)(sizeof(xicmp_hdr_t) + payload);
+    uint16_t total_len = (uint16_t)(sizeof(xip_hdr_t) + icmp_len);
+
+    bench_fill_ether(frame, XNET_PROTOCOL_IP);
+    memset(icmp, 0, sizeof(xicmp_hdr_t));
+    icmp->type = XICMP_TYPE_ECHO_REQUEST;
+    icmp->id = 0x3412;
+    icmp->seq = 0x0100;
+    memset(icmp + 1, 'A', payload);
+    icmp->checksum = bench_checksum(icmp, icmp_len);
+
+    memset(ip, 0, sizeof(xip_hdr_t));
+    ip->ver_hdrlen = 0x45;
+    ip->total_len = (uint16_t)((total_len >> 8) | (total_len << 8));
+    ip->ttl = 64;
+    ip->protocol = XIP_PROTOCOL_ICMP;
+    memcpy(ip->src_ip, peer_ip, XNET_IP_ADDR_SIZE);
+    memcpy(ip->dest_ip, stack_ip, XNET_IP_ADDR_SIZE);
+    ip->hdr_checksum = bench_checksum(ip, sizeof(xip_hdr_t));
+    return (uint16_t)(sizeof(xether_hdr_t) + total_len);
+}
+
+/**
+ * 协议栈发出的帧是否为 Echo Reply：ARP 等其它帧不计入回复数
+ */
+static int bench_is_echo_reply(const uint8_t * frame, uint32_t size) {
+    const xether_hdr_t * ether = (const xether_hdr_t *)frame;
+    const xip_hdr_t * ip = (const xip_hdr_t *)(frame + sizeof(xether_hdr_t));
+    uint32_t ip_hdr_len;
+
+    if ((size < sizeof(xether_hdr_t) + sizeof(xip_hdr_t))
+        || (ether->protocol != (uint16_t)((XNET_PROTOCOL_IP >> 8) | (XNET_PROTOCOL_IP << 8)))
+        || (ip->protocol != XIP_PROTOCOL_ICMP)) {
+        return 0;
+    }
+
+    ip_hdr_len = (uint32_t)(ip->ver_hdrlen & 0x0F) * 4;
+    return (size > sizeof(xether_hdr_t) + ip_hdr_len)
+           && (frame[sizeof(xether_hdr_t) + ip_hdr_len] == XICMP_TYPE_ECHO_REPLY);
+}
+
+/**
+ * 在虚拟线缆上测量协议栈每帧的处理开销
+ */
+static void bench_wire(int seconds, uint16_t payload) {
+    static uint8_t arp_frame[64], echo_frame[XNET_CFG_PACKET_MAX_SIZE];
+    vwire_end_t * peer = vwire_device_open("vwire0");
+    uint16_t arp_len = bench_build_arp_reply(arp_frame);
+    uint16_t echo_len;
+    uint64_t start, last_seed, stack_ns = 0, frames = 0, replies = 0;
+
+    if (payload > xnet_get_mtu() - sizeof(xip_hdr_t) - sizeof(xicmp_hdr_t)) {
+        payload = (uint16_t)(xnet_get_mtu() - sizeof(xip_hdr_t) - sizeof(xicmp_hdr_t));
+    }
+    echo_len = bench_build_echo(echo_frame, payload);
+
+    start = bench_now_ns();
+    last_seed = 0;
+    while (bench_now_ns() - start < (uint64_t)seconds * BENCH_NS_PER_SEC) {
+        const uint8_t * out[XNET_CFG_RX_BATCH];
+        uint32_t out_len[XNET_CFG_RX_BATCH];
+        uint32_t count, injected = 0;
+        uint64_t t0;
+
+        // 每秒重新通告一次对端 MAC，避免 ARP 表项过期
+        if (bench_now_ns() - last_seed >= BENCH_NS_PER_SEC) {
+            last_seed = bench_now_ns();
+            vwire_device_send(peer, arp_frame, arp_len);
+        }
+
+        while ((injected < XNET_CFG_RX_BATCH) && vwire_device_send(peer, echo_frame, echo_len)) {
+            injected++;
+        }
+
+        t0 = bench_now_ns();
+        xnet_poll();
+        stack_ns += bench_now_ns() - t0;
+        frames += injected;
+
+        while ((count = vwire_device_read_batch(peer, out, out_len, XNET_CFG_RX_BATCH)) > 0) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (bench_is_echo_reply(out[i], out_len[i])) {
+                    replies++;
+                }
+            }
+            vwire_device_release(peer, count);
+        }
+    }
+
+    fprintf(stderr, "wire: payload %u bytes, %llu requests, %llu replies\n",
+            payload, (unsigned long long)frames, (unsigned long long)replies);
+    if (frames) {
+        fprintf(stderr, "wire: %.1f ns/frame in xnet_poll(), ceiling %.0f pps\n",
+                (double)stack_ns / (double)frames,
+                (double)frames * BENCH_NS_PER_SEC / (double)stack_ns);
+    }
+    fprintf(stderr, "wire: checksum verification skipped, ip %u, icmp %u\n",
+            xnet_get_stats()->ip_csum_skipped, xnet_get_stats()->icmp_csum_skipped);
+    fprintf(stderr, "wire: packet pool %u/%u in use, high water %u, alloc failures %u\n",
+            xnet_pool_get_stats()->in_use, xnet_pool_get_stats()->size,
+            xnet_pool_get_stats()->high_water, xnet_pool_get_stats()->alloc_fail);
+}
+#endif
+
+#if defined(NET_DRIVER_SAVEFILE)
+int xnet_driver_replay_done (void);
+
+/**
+ * 回放抓包文件，测量协议栈处理每帧的耗时
+ */
+static void bench_replay(const xnet_stats_t * stats) {
+    uint64_t start = bench_now_ns(), stack_ns = 0, worst_ns = 0;
+    uint32_t busy_polls = 0;
+
+    while (!xnet_driver_replay_done()) {
+        uint32_t rx = stats->rx_packets;
+        uint64_t t0 = bench_now_ns(), cost;
+
+        xnet_poll();
+        cost = bench_now_ns() - t0;
+        if (stats->rx_packets != rx) {
+            uint64_t per_frame = cost / (stats->rx_packets - rx);
+
+            stack_ns += cost;
+            worst_ns = per_frame > worst_ns ? per_frame : worst_ns;
+            busy_polls++;
+        }
+    }
+
+    fprintf(stderr, "replay: %u frames in, %u frames out, %u polls, %.3f s\n",
+            stats->rx_packets, stats->tx_packets, busy_polls,
+            (double)(bench_now_ns() - start) / BENCH_NS_PER_SEC);
+    if (stats->rx_packets) {
+        fprintf(stderr, "replay: %.1f ns/frame avg, %llu ns/frame worst poll, ceiling %.0f pps\n",
+                (double)stack_ns / stats->rx_packets, (unsigned long long)worst_ns,
+                (double)stats->rx_packets * BENCH_NS_PER_SEC / (double)stack_ns);
+    }
+}
+#endif
+
+int main (int argc, char ** argv) {
+    int tx_mode = (argc > 1) && (strcmp(argv[1], "tx") == 0);
+    int seconds = (argc > 2) ? atoi(argv[2]) : 10;
+    const xnet_stats_t * stats;
+    uint32_t last_rx = 0, last_tx = 0, tx_frames = 0, last_tx_frames = 0;
+    uint64_t start, last;
+
+    // XNET_CAPTURE=文件名 时抓取所有收发的帧，扩展名为 .pcapng 时写 pcapng 格式
+    const char * capture = getenv("XNET_CAPTURE");
+    if (capture) {
+        xnet_capture_open(capture, strstr(capture, ".pcapng") ? XNET_CAPTURE_PCAPNG : XNET_CAPTURE_PCAP);
+    }
+
+    // XNET_MTU=9000 时使用 jumbo 帧，不能超过编译时的上限 XNET_CFG_MTU
+    const char * mtu = getenv("XNET_MTU");
+    if (mtu && (xnet_set_mtu((uint16_t)atoi(mtu)) != XNET_ERR_OK)) {
+        fprintf(stderr, "MTU %s out of range (68-%d)\n", mtu, XNET_CFG_MTU);
+    }
+
+    if ((argc > 1) && (strcmp(argv[1], "wire") == 0)) {
+#if defined(NET_DRIVER_VWIRE)
+        xnet_driver_select("vwire");
+        xnet_init();
+        bench_wire(seconds, (uint16_t)((argc > 3) ? atoi(argv[3]) : 56));
+#else
+        fprintf(stderr, "wire mode needs the vwire driver built in\n");
+#endif
+        return 0;
+    }
+
+    if ((argc > 1) && (strcmp(argv[1], "replay") == 0)) {
+#if defined(NET_DRIVER_SAVEFILE)
+        xnet_driver_select("savefile");
+        xnet_init();
+        bench_replay(xnet_get_stats());
+#else
+        fprintf(stderr, "replay mode needs the savefile driver built in\n");
+#endif
+        return 0;
+    }
+
+    xnet_init();
+    stats = xnet_get_stats();
+
+    start = last = bench_now_ns();
+    while (1) {
+        uint64_t now;
+
+        if (tx_mode) {
+            bench_tx_one();
+            tx_frames++;
+        } else {
+            xnet_poll();
+        }
+
+        now = bench_now_ns();
+        if (now - last >= BENCH_NS_PER_SEC) {
+            double elapsed = (double)(now - last) / BENCH_NS_PER_SEC;
+
+            if (tx_mode) {
+                printf("tx: %.0f pps\n", (tx_frames - last_tx_frames) / elapsed);
+                last_tx_frames = tx_frames;
+            } else {
+                printf("rx: %.0f pps, tx: %.0f pps, polls: %u, empty: %u, max/poll: %u, kernel drop: %u, "
+                       "filtered kernel/user: %u/%u\n",
+                       (stats->rx_packets - last_rx) / elapsed,
+                       (stats->tx_packets - last_tx) / elapsed,
+                       stats->polls, stats->empty_polls, stats->max_poll_packets,
+                       stats->driver.drop + stats->driver.ifdrop, stats->driver.filtered, stats->rx_filtered);
+                last_rx = stats->rx_packets;
+                last_tx = stats->tx_packets;
+            }
+            last = now;
+
+            if (now - start >= (uint64_t)seconds * BENCH_NS_PER_SEC) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
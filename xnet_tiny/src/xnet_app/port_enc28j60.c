@@ -0,0 +1,240 @@
+#if defined(NET_DRIVER_ENC28J60)
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "enc28j60_device.h"
+#include "tap_device.h"
+#include "xnet_tiny.h"
+
+/**
+ * 在主机上运行 STM32 的 ENC28J60 固件驱动：SPI 接到 enc28j60_emu.c 的寄存器模型，
+ * 芯片的线缆一端接到 TAP 设备。用于测量固件收发每帧所需的 SPI 命令数、字节数与 bank 切换次数
+ */
+static int tap = -1;
+static uint8_t wire_frame[TAP_RX_FRAME_SIZE];   // 从 TAP 读出、芯片接收缓冲区暂时放不下的帧
+static uint32_t wire_size;
+static uint8_t spi_report;                      // 环境变量 XNET_SPI_STATS 存在时打印每帧的 SPI 开销
+static enc28j60_emu_stats_t rx_cost, tx_cost;   // 接收与发送各自累计的 SPI 开销
+static uint32_t rx_count, tx_count;             // 对应的帧数
+static uint32_t report_rx, report_tx;           // 上次打印时的帧数
+
+// 所用的 TAP 网卡名称，可用环境变量 XNET_IF 覆盖
+static const char * if_name = "tap0";
+static const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+
+/**
+ * 芯片发出的帧写入 TAP 设备
+ */
+static void enc28j60_wire_send (void * arg, const uint8_t * frame, uint32_t size) {
+    tap_device_send(tap, frame, size);
+}
+
+/**
+ * 把 TAP 上到达的帧交给芯片；芯片的接收缓冲区放不下时留到下一次，
+ * 相当于线缆另一端在等待，不在模型中丢帧
+ */
+static void enc28j60_wire_pump (void) {
+    for (;;) {
+        if (wire_size == 0) {
+            wire_size = tap_device_read(tap, wire_frame, sizeof(wire_frame));
+            if (wire_size == 0) {
+                return;
+            }
+        }
+
+        if (enc28j60_emu_receive(wire_frame, wire_size) < 0) {
+            return;
+        }
+        wire_size = 0;
+    }
+}
+
+/**
+ * 把从 start 开始的 SPI 开销累加到 cost 中
+ */
+static void enc28j60_cost_add (enc28j60_emu_stats_t * cost, const enc28j60_emu_stats_t * start) {
+    enc28j60_emu_stats_t now;
+
+    enc28j60_emu_get_stats(&now);
+    cost->spi_transactions += now.spi_transactions - start->spi_transactions;
+    cost->spi_bytes += now.spi_bytes - start->spi_bytes;
+    cost->bank_switches += now.bank_switches - start->bank_switches;
+}
+
+/**
+ * 初始化网络驱动
+ * @return 0成功，其它失败
+ */
+static xnet_err_t enc28j60_driver_open (uint8_t * mac_addr) {
+    const char * env_name = getenv("XNET_IF");
+
+    memcpy(mac_addr, my_mac_addr, sizeof(my_mac_addr));
+    tap = tap_device_open(env_name ? env_name : if_name, 1);
+    if (tap < 0) {
+        exit(-1);
+    }
+
+    enc28j60_emu_init(enc28j60_wire_send, (void *)0);
+    if (ENC28J60_Init(mac_addr) != 0) {
+        printf("enc28j60: init failed\n");
+        exit(-1);
+    }
+
+    spi_report = getenv("XNET_SPI_STATS") != (char *)0;
+    printf("enc28j60: rev %d, rx buffer %d bytes\n", ENC28J60_Get_EREVID(), RXSTOP_INIT - RXSTART_INIT + 1);
+    return XNET_ERR_OK;
+}
+
+/**
+ * 发送数据：固件立即把帧写入芯片并启动发送
+ * @param frame 数据起始地址
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t enc28j60_driver_send (xnet_packet_t * packet) {
+    enc28j60_emu_stats_t start;
+
+    enc28j60_emu_get_stats(&start);
+    ENC28J60_Packet_Send(packet->size, packet->data);
+    enc28j60_cost_add(&tx_cost, &start);
+    tx_count++;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 读取数据：每次读一帧，按固件原有的方式先查 EPKTCNT 再读取并释放
+ * @param frame 数据存储位置
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t enc28j60_driver_read (xnet_packet_t ** packet) {
+    enc28j60_emu_stats_t start;
+    xnet_packet_t * r_packet;
+    uint32_t size;
+
+    enc28j60_wire_pump();
+    if (!enc28j60_emu_int()) {
+        return XNET_ERR_IO;
+    }
+
+    r_packet = xnet_alloc_for_read(XNET_CFG_PACKET_MAX_SIZE);
+    if (r_packet == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
+    }
+
+    enc28j60_emu_get_stats(&start);
+    size = ENC28J60_Packet_Receive(XNET_CFG_PACKET_MAX_SIZE, r_packet->data);
+    enc28j60_cost_add(&rx_cost, &start);
+    if (size == 0) {
+        xnet_free(r_packet);
+        return XNET_ERR_IO;
+    }
+
+    rx_count++;
+    r_packet->size = (uint16_t)size;
+    *packet = r_packet;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 批量读取数据：INT 引脚有效时读一次 EPKTCNT，随后每帧用一条 RBM 命令直接读入数据包，
+ * 最后一次性释放接收缓冲区空间
+ * @param packets 数据包数组
+ * @param max 最多读取的数量
+ * @return 读到的数据包数量
+ */
+static uint16_t enc28j60_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    enc28j60_emu_stats_t start;
+    uint16_t n = 0;
+    uint8_t count;
+
+    enc28j60_wire_pump();
+    if (!enc28j60_emu_int()) {
+        return 0;
+    }
+
+    enc28j60_emu_get_stats(&start);
+    count = ENC28J60_Packet_Count();
+    for (uint16_t i = 0; (i < count) && (i < max); i++) {
+        xnet_packet_t * r_packet = &packets[n];
+        uint32_t size = ENC28J60_Packet_Read(XNET_CFG_PACKET_MAX_SIZE, xnet_packet_frame(r_packet));
+
+        rx_count++;
+        if (size == 0) {
+            continue;
+        }
+
+        r_packet->data = xnet_packet_frame(r_packet);
+        r_packet->size = (uint16_t)size;
+        n++;
+    }
+    ENC28J60_Packet_Free();
+    enc28j60_cost_add(&rx_cost, &start);
+    return n;
+}
+
+/**
+ * 数据已读入协议栈的缓冲区，无需归还
+ * @param packets 数据包数组
+ * @param count 数量
+ */
+static void enc28j60_driver_release (xnet_packet_t * packets, uint16_t count) {
+}
+
+/**
+ * 等待芯片中有帧可读，或 TAP 上有帧到达
+ * @param timeout_ms 最长等待时间
+ * @return 0 - 有数据包，其它 - 超时
+ */
+static xnet_err_t enc28j60_driver_wait (uint32_t timeout_ms) {
+    if (enc28j60_emu_int() || wire_size) {
+        return XNET_ERR_OK;
+    }
+    return tap_device_wait(tap, (int)timeout_ms) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 读取芯片的接收统计；设置了 XNET_SPI_STATS 时，有新的收发就打印每帧的 SPI 开销
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t enc28j60_driver_stats (xnet_driver_stats_t * stats) {
+    enc28j60_emu_stats_t emu;
+
+    enc28j60_emu_get_stats(&emu);
+    stats->recv = emu.rx_frames;
+    stats->drop = emu.rx_dropped;
+    stats->ifdrop = 0;
+    stats->filtered = emu.rx_filtered;
+
+    if (spi_report && ((rx_count != report_rx) || (tx_count != report_tx))) {
+        report_rx = rx_count;
+        report_tx = tx_count;
+        printf("enc28j60 spi per frame: rx %.2f cmds %.1f bytes %.2f bank switches (%u frames), "
+               "tx %.2f cmds %.1f bytes %.2f bank switches (%u frames)\n",
+               rx_count ? (double)rx_cost.spi_transactions / rx_count : 0.0,
+               rx_count ? (double)rx_cost.spi_bytes / rx_count : 0.0,
+               rx_count ? (double)rx_cost.bank_switches / rx_count : 0.0, rx_count,
+               tx_count ? (double)tx_cost.spi_transactions / tx_count : 0.0,
+               tx_count ? (double)tx_cost.spi_bytes / tx_count : 0.0,
+               tx_count ? (double)tx_cost.bank_switches / tx_count : 0.0, tx_count);
+    }
+    return XNET_ERR_OK;
+}
+
+/**
+ * ENC28J60 固件驱动 + 主机端芯片模型，线缆接到 Linux TAP 设备
+ */
+const xnet_driver_ops_t xnet_driver_enc28j60 = {
+    .name = "enc28j60",
+    .caps = XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_WAIT,
+    .open = enc28j60_driver_open,
+    .send = enc28j60_driver_send,
+    .read = enc28j60_driver_read,
+    .read_batch = enc28j60_driver_read_batch,
+    .release = enc28j60_driver_release,
+    .wait = enc28j60_driver_wait,
+    .stats = enc28j60_driver_stats,
+};
+
+#endif
@@ -1,52 +1,188 @@
-﻿#include <string.h>
+﻿#if defined(NET_DRIVER_PCAP)
+
+#include <string.h>
 #include <stdlib.h>
 #include "pcap_device.h"
 #include "xnet_tiny.h"
 
 static pcap_t * pcap;
+static pcap_device_txq_t * txq;
+static uint32_t snaplen;                            // 按运行时的 MTU 只捕获协议栈会处理的长度
 
-// pcap所用的网卡
-const char * ip_str = "192.168.232.1";      // 根据实际电脑上存在的网卡地址进行修改
-const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+// pcap所用的网卡，可用环境变量 XNET_IP 覆盖
+static const char * ip_str = "192.168.232.1";      // 根据实际电脑上存在的网卡地址进行修改
+static const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
 /**00-50-56-C0-00-01
  * 初始化网络驱动
  * @return 0成功，其它失败
  */
-xnet_err_t xnet_driver_open (uint8_t * mac_addr) {
+static xnet_err_t pcap_driver_open (uint8_t * mac_addr) {
+    const char * env_ip = getenv("XNET_IP");
+    const char * env_buffer = getenv("XNET_PCAP_BUFFER");
+    pcap_device_opt_t opt;
+
+    // 低延迟：立即模式、非阻塞读取，只捕获协议栈能处理的长度；内核缓冲区可用环境变量 XNET_PCAP_BUFFER 调整
+    pcap_device_opt_init(&opt);
+    opt.poll_mode = 1;
+    opt.immediate = 1;
+    snaplen = xnet_get_mtu() + XNET_ETHER_OVERHEAD;
+    opt.snaplen = snaplen;
+    opt.direction = PCAP_D_IN;
+    if (env_buffer) {
+        opt.buffer_size = (uint32_t)strtoul(env_buffer, (char **)0, 0);
+    }
+
     memcpy(mac_addr, my_mac_addr, sizeof(my_mac_addr));
-    pcap = pcap_device_open(ip_str, mac_addr, 1);
+    pcap = pcap_device_open_opt(env_ip ? env_ip : ip_str, mac_addr, &opt);
     if (pcap == (pcap_t *)0) {
         exit(-1);
     }
+
+    txq = pcap_device_txq_open(pcap, XNET_CFG_TX_QUEUE_DEPTH, XNET_CFG_PACKET_MAX_SIZE);
+    if (txq == (pcap_device_txq_t *)0) {
+        exit(-1);
+    }
     return XNET_ERR_OK;
 }
 
 /**
- * 发送数据
+ * 发送数据：放入发送队列，队列满时自动发送
  * @param frame 数据起始地址
  * @param size 数据长度
  * @return 0 - 成功，其它失败
  */
-xnet_err_t xnet_driver_send (xnet_packet_t * packet) {
-    return pcap_device_send(pcap, packet->data, packet->size);
+static xnet_err_t pcap_driver_send (xnet_packet_t * packet) {
+    return pcap_device_txq_send(txq, packet->data, packet->size) ? XNET_ERR_IO : XNET_ERR_OK;
+}
+
+/**
+ * 一次发送队列中所有的帧
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t pcap_driver_flush (void) {
+    pcap_device_txq_flush(txq);
+    return XNET_ERR_OK;
 }
 
 /**
- * 读取数据
+ * 读取数据：数据包直接指向 pcap 的缓冲区，不做拷贝，协议栈只读
  * @param frame 数据存储位置
  * @param size 数据长度
  * @return 0 - 成功，其它失败
  */
-xnet_err_t xnet_driver_read (xnet_packet_t ** packet) {
-    uint16_t size;
-    xnet_packet_t * r_packet = xnet_alloc_for_read(XNET_CFG_PACKET_MAX_SIZE);
+static xnet_err_t pcap_driver_read (xnet_packet_t ** packet) {
+    uint32_t size;
+    uint64_t timestamp;
+    const uint8_t * frame;
 
-    size = pcap_device_read(pcap, r_packet->data, XNET_CFG_PACKET_MAX_SIZE);
-    if (size) {
-        r_packet->size = size;
-        *packet = r_packet;
-        return XNET_ERR_OK;
+    do {
+        frame = pcap_device_read_ref(pcap, &size, &timestamp);
+        if (frame == (const uint8_t *)0) {
+            return XNET_ERR_IO;
+        }
+    } while (size > snaplen);
+
+    *packet = xnet_alloc_for_read((uint16_t)size);
+    if (*packet == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
     }
+    (*packet)->data = (uint8_t *)frame;
+    (*packet)->rx_ts_ns = timestamp;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 批量读取数据：pcap 的缓冲区在下一次读取时失效，因此每批只借出一帧，
+ * 由 ethernet_poll 反复调用直到没有数据包或用完预算
+ * @param packets 数据包数组
+ * @param max 最多读取的数量
+ * @return 读到的数据包数量
+ */
+static uint16_t pcap_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    uint32_t size;
+    uint64_t timestamp;
+    const uint8_t * frame;
+
+    do {
+        frame = pcap_device_read_ref(pcap, &size, &timestamp);
+        if (frame == (const uint8_t *)0) {
+            return 0;
+        }
+    } while (size > snaplen);
 
-    return XNET_ERR_IO;
+    packets[0].data = (uint8_t *)frame;
+    packets[0].size = (uint16_t)size;
+    packets[0].rx_ts_ns = timestamp;
+    return 1;
 }
+
+/**
+ * 协议栈已处理完借出的帧，pcap 的缓冲区由下一次读取自动回收
+ * @param packets 数据包数组
+ * @param count 数量
+ */
+static void pcap_driver_release (xnet_packet_t * packets, uint16_t count) {
+}
+
+/**
+ * 等待网卡有数据包可读
+ * @param timeout_ms 最长等待时间
+ * @return 0 - 有数据包，其它 - 超时
+ */
+static xnet_err_t pcap_driver_wait (uint32_t timeout_ms) {
+    return pcap_device_wait(pcap, (int)timeout_ms) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 读取 pcap_stats() 给出的接收与丢帧统计
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t pcap_driver_stats (xnet_driver_stats_t * stats) {
+    pcap_device_stats_t ps;
+
+    if (pcap_device_stats(pcap, &ps) != 0) {
+        return XNET_ERR_IO;
+    }
+
+    stats->recv = ps.recv;
+    stats->drop = ps.drop;
+    stats->ifdrop = ps.ifdrop;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 启动接收线程，pcap_dispatch 收到的帧通过 handler 交给协议栈
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t pcap_driver_start_rx (irq_handler_t handler, void * arg) {
+    return pcap_device_start_rx(pcap, handler, arg) ? XNET_ERR_IO : XNET_ERR_OK;
+}
+
+/**
+ * 在内核中安装协议栈给出的接收过滤器
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t pcap_driver_set_filter (const net_filter_t * filter) {
+    return pcap_device_set_filter(pcap, filter) ? XNET_ERR_IO : XNET_ERR_OK;
+}
+
+/**
+ * npcap/libpcap 驱动
+ */
+const xnet_driver_ops_t xnet_driver_pcap = {
+    .name = "pcap",
+    .caps = XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_ZERO_COPY | XNET_DRIVER_CAP_WAIT | XNET_DRIVER_CAP_RX_TIMESTAMP
+            | XNET_DRIVER_CAP_IRQ,
+    .open = pcap_driver_open,
+    .send = pcap_driver_send,
+    .read = pcap_driver_read,
+    .read_batch = pcap_driver_read_batch,
+    .flush = pcap_driver_flush,
+    .release = pcap_driver_release,
+    .wait = pcap_driver_wait,
+    .stats = pcap_driver_stats,
+    .start_rx = pcap_driver_start_rx,
+    .set_filter = pcap_driver_set_filter,
+};
+
+#endif
@@ -0,0 +1,144 @@
+#if defined(NET_DRIVER_SAVEFILE)
+
+#include <string.h>
+#include <stdlib.h>
+#include "savefile_device.h"
+#include "xnet_tiny.h"
+
+static savefile_device_t * savefile;
+
+// 回放的抓包文件及发出数据包的保存位置，可用环境变量 XNET_PCAP_IN、XNET_PCAP_OUT 覆盖；
+// XNET_PCAP_SPEED=real 时按抓包时的间隔回放，否则尽可能快地回放
+static const char * in_path = "replay.pcap";
+static const char * out_path = "replay_out.pcap";
+static const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+
+/**
+ * 初始化网络驱动
+ * @return 0成功，其它失败
+ */
+static xnet_err_t savefile_driver_open (uint8_t * mac_addr) {
+    const char * env_in = getenv("XNET_PCAP_IN");
+    const char * env_out = getenv("XNET_PCAP_OUT");
+    const char * env_speed = getenv("XNET_PCAP_SPEED");
+    uint8_t mode = SAVEFILE_MODE_MAX_SPEED;
+
+    if (env_speed && (strcmp(env_speed, "real") == 0)) {
+        mode = SAVEFILE_MODE_REAL_TIME;
+    }
+
+    memcpy(mac_addr, my_mac_addr, sizeof(my_mac_addr));
+    savefile = savefile_device_open(env_in ? env_in : in_path, env_out ? env_out : out_path, mode);
+    if (savefile == (savefile_device_t *)0) {
+        exit(-1);
+    }
+    return XNET_ERR_OK;
+}
+
+/**
+ * 回放是否已结束，供测试程序判断何时停止
+ * @return 非 0 表示输入文件已全部读出
+ */
+int xnet_driver_replay_done (void) {
+    return savefile_device_eof(savefile);
+}
+
+/**
+ * 发送数据：写入输出文件
+ * @param frame 数据起始地址
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t savefile_driver_send (xnet_packet_t * packet) {
+    return savefile_device_send(savefile, packet->data, packet->size) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 输出文件由 stdio 缓冲，无需提交
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t savefile_driver_flush (void) {
+    return XNET_ERR_OK;
+}
+
+/**
+ * 读取数据
+ * @param frame 数据存储位置
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t savefile_driver_read (xnet_packet_t ** packet) {
+    uint32_t size;
+    xnet_packet_t * r_packet = xnet_alloc_for_read(XNET_CFG_PACKET_MAX_SIZE);
+
+    if (r_packet == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
+    }
+
+    size = savefile_device_read(savefile, r_packet->data, XNET_CFG_PACKET_MAX_SIZE);
+    if (size) {
+        r_packet->size = (uint16_t)size;
+        *packet = r_packet;
+        return XNET_ERR_OK;
+    }
+
+    xnet_free(r_packet);
+    return XNET_ERR_IO;
+}
+
+/**
+ * 批量读取数据：连续读出已到期的帧，直到读满
+ * @param packets 数据包数组
+ * @param max 最多读取的数量
+ * @return 读到的数据包数量
+ */
+static uint16_t savefile_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    uint16_t n;
+
+    for (n = 0; n < max; n++) {
+        xnet_packet_t * r_packet = &packets[n];
+        uint32_t size = savefile_device_read(savefile, xnet_packet_frame(r_packet), XNET_CFG_PACKET_MAX_SIZE);
+        if (size == 0) {
+            break;
+        }
+
+        r_packet->data = xnet_packet_frame(r_packet);
+        r_packet->size = (uint16_t)size;
+    }
+
+    return n;
+}
+
+/**
+ * 数据已拷贝到协议栈的缓冲区，无需归还
+ * @param packets 数据包数组
+ * @param count 数量
+ */
+static void savefile_driver_release (xnet_packet_t * packets, uint16_t count) {
+}
+
+/**
+ * 等待下一帧到期，实时回放时按抓包间隔休眠
+ * @param timeout_ms 最长等待时间
+ * @return 0 - 有数据包，其它 - 超时或已回放完
+ */
+static xnet_err_t savefile_driver_wait (uint32_t timeout_ms) {
+    return savefile_device_wait(savefile, (int)timeout_ms) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * .pcap 抓包文件回放驱动
+ */
+const xnet_driver_ops_t xnet_driver_savefile = {
+    .name = "savefile",
+    .caps = XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_WAIT,
+    .open = savefile_driver_open,
+    .send = savefile_driver_send,
+    .read = savefile_driver_read,
+    .read_batch = savefile_driver_read_batch,
+    .flush = savefile_driver_flush,
+    .release = savefile_driver_release,
+    .wait = savefile_driver_wait,
+};
+
+#endif
@@ -0,0 +1,141 @@
+#if defined(NET_DRIVER_TAP)
+
+#include <string.h>
+#include <stdlib.h>
+#include "tap_device.h"
+#include "xnet_tiny.h"
+
+static int tap = -1;
+
+// 所用的 TAP 网卡名称，可用环境变量 XNET_IF 覆盖
+static const char * if_name = "tap0";
+static const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+
+/**
+ * 初始化网络驱动
+ * @return 0成功，其它失败
+ */
+static xnet_err_t tap_driver_open (uint8_t * mac_addr) {
+    const char * env_name = getenv("XNET_IF");
+
+    memcpy(mac_addr, my_mac_addr, sizeof(my_mac_addr));
+    tap = tap_device_open(env_name ? env_name : if_name, 1);
+    if (tap < 0) {
+        exit(-1);
+    }
+
+    // 主机侧默认 1500，jumbo 帧时按协议栈的 MTU 调整，否则主机不会发出更大的帧
+    if (xnet_get_mtu() > 1500) {
+        tap_device_set_mtu(env_name ? env_name : if_name, xnet_get_mtu());
+    }
+    return XNET_ERR_OK;
+}
+
+/**
+ * 发送数据：TAP 每帧都需要一次 write，没有可合并的系统调用，直接发送
+ * @param frame 数据起始地址
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tap_driver_send (xnet_packet_t * packet) {
+    return tap_device_send(tap, packet->data, packet->size) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 发送在 xnet_driver_send 中已完成，无需提交
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tap_driver_flush (void) {
+    return XNET_ERR_OK;
+}
+
+/**
+ * 读取数据
+ * @param frame 数据存储位置
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tap_driver_read (xnet_packet_t ** packet) {
+    uint32_t size;
+    xnet_packet_t * r_packet = xnet_alloc_for_read(XNET_CFG_PACKET_MAX_SIZE);
+
+    if (r_packet == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
+    }
+
+    size = tap_device_read(tap, r_packet->data, XNET_CFG_PACKET_MAX_SIZE);
+    if (size) {
+        r_packet->size = (uint16_t)size;
+        *packet = r_packet;
+        return XNET_ERR_OK;
+    }
+
+    xnet_free(r_packet);
+    return XNET_ERR_IO;
+}
+
+/**
+ * 批量读取数据：非阻塞地连续读取，直到没有数据包或读满
+ * @param packets 数据包数组
+ * @param max 最多读取的数量
+ * @return 读到的数据包数量
+ */
+static uint16_t tap_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    uint16_t n;
+
+    for (n = 0; n < max; n++) {
+        xnet_packet_t * r_packet = &packets[n];
+        uint32_t size = tap_device_read(tap, xnet_packet_frame(r_packet), XNET_CFG_PACKET_MAX_SIZE);
+        if (size == 0) {
+            break;
+        }
+
+        r_packet->data = xnet_packet_frame(r_packet);
+        r_packet->size = (uint16_t)size;
+    }
+
+    return n;
+}
+
+/**
+ * 数据已拷贝到协议栈的缓冲区，无需归还
+ * @param packets 数据包数组
+ * @param count 数量
+ */
+static void tap_driver_release (xnet_packet_t * packets, uint16_t count) {
+}
+
+/**
+ * 等待 TAP 设备有数据包可读
+ * @param timeout_ms 最长等待时间
+ * @return 0 - 有数据包，其它 - 超时
+ */
+static xnet_err_t tap_driver_wait (uint32_t timeout_ms) {
+    return tap_device_wait(tap, (int)timeout_ms) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 启动接收线程，收到的帧通过 handler 交给协议栈
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tap_driver_start_rx (irq_handler_t handler, void * arg) {
+    return tap_device_start_rx(tap, handler, arg) ? XNET_ERR_IO : XNET_ERR_OK;
+}
+
+/**
+ * Linux TAP 设备驱动
+ */
+const xnet_driver_ops_t xnet_driver_tap = {
+    .name = "tap",
+    .caps = XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_WAIT | XNET_DRIVER_CAP_IRQ,
+    .open = tap_driver_open,
+    .send = tap_driver_send,
+    .read = tap_driver_read,
+    .read_batch = tap_driver_read_batch,
+    .flush = tap_driver_flush,
+    .release = tap_driver_release,
+    .wait = tap_driver_wait,
+    .start_rx = tap_driver_start_rx,
+};
+
+#endif
@@ -0,0 +1,231 @@
+#if defined(NET_DRIVER_TPACKET)
+
+#include <string.h>
+#include <stdlib.h>
+#include "tpacket_device.h"
+#include "xnet_tiny.h"
+
+static tpacket_device_t * tpacket;
+static uint16_t tx_pending;                 // 发送环中尚未提交给内核的帧数
+static uint8_t tx_stamp;                    // 下一次提交需要内核生成发送时间戳
+static uint8_t stamp_frame[XNET_CFG_PACKET_MAX_SIZE];   // 从错误队列取回的已发出帧
+static xnet_err_t tpacket_driver_flush (void);
+
+/**
+ * 把内核给出的校验和状态转换为数据包标志
+ */
+static uint8_t tpacket_csum_flags (uint8_t csum) {
+    return ((csum & TPACKET_CSUM_VALID) ? XNET_PACKET_CSUM_VALID : 0)
+           | ((csum & TPACKET_CSUM_PARTIAL) ? XNET_PACKET_CSUM_PARTIAL : 0);
+}
+
+// 所用的网卡名称，可用环境变量 XNET_IF 覆盖
+static const char * if_name = "veth1";      // 根据实际电脑上存在的网卡名进行修改
+static const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+
+/**
+ * 初始化网络驱动
+ * @return 0成功，其它失败
+ */
+static xnet_err_t tpacket_driver_open (uint8_t * mac_addr) {
+    const char * env_name = getenv("XNET_IF");
+
+    memcpy(mac_addr, my_mac_addr, sizeof(my_mac_addr));
+    tpacket = tpacket_device_open(env_name ? env_name : if_name, mac_addr, 1);
+    if (tpacket == (tpacket_device_t *)0) {
+        exit(-1);
+    }
+    return XNET_ERR_OK;
+}
+
+/**
+ * 发送数据：放入发送环，积累到队列深度时自动提交
+ * @param frame 数据起始地址
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tpacket_driver_send (xnet_packet_t * packet) {
+    if (!tpacket_device_send(tpacket, packet->data, packet->size)) {
+        return XNET_ERR_IO;
+    }
+    if (packet->flags & XNET_PACKET_TX_TIMESTAMP) {
+        tx_stamp = 1;
+    }
+
+    if (++tx_pending >= XNET_CFG_TX_QUEUE_DEPTH) {
+        tpacket_driver_flush();
+    }
+    return XNET_ERR_OK;
+}
+
+/**
+ * 一次提交发送环中所有待发送的帧
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tpacket_driver_flush (void) {
+    uint8_t stamp;
+
+    if (tx_pending == 0) {
+        return XNET_ERR_OK;
+    }
+
+    tx_pending = 0;
+    stamp = tx_stamp;
+    tx_stamp = 0;
+    return tpacket_device_flush(tpacket, stamp) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 读取数据：数据包直接指向接收环中的帧，不做拷贝，协议栈只读
+ * @param frame 数据存储位置
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tpacket_driver_read (xnet_packet_t ** packet) {
+    uint32_t size;
+    uint64_t timestamp;
+    uint8_t csum;
+    const uint8_t * frame = tpacket_device_read(tpacket, &size, &timestamp, &csum);
+    xnet_packet_t * r_packet;
+
+    if ((frame == (const uint8_t *)0) || (size > XNET_CFG_PACKET_MAX_SIZE)) {
+        return XNET_ERR_IO;
+    }
+
+    r_packet = xnet_alloc_for_read((uint16_t)size);
+    if (r_packet == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
+    }
+    r_packet->data = (uint8_t *)frame;
+    r_packet->rx_ts_ns = timestamp;
+    r_packet->flags = tpacket_csum_flags(csum);
+    *packet = r_packet;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 批量读取数据：整批帧都来自接收环的同一个块，处理完之前不会被内核覆盖。
+ * 一批帧全部因超长被丢弃时接着读，返回 0 只表示接收环已空
+ * @param packets 数据包数组
+ * @param max 最多读取的数量
+ * @return 读到的数据包数量
+ */
+static uint16_t tpacket_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    const uint8_t * frames[XNET_CFG_RX_BATCH];
+    uint32_t sizes[XNET_CFG_RX_BATCH];
+    uint64_t timestamps[XNET_CFG_RX_BATCH];
+    uint8_t csums[XNET_CFG_RX_BATCH];
+    uint32_t count;
+    uint16_t n = 0;
+
+    if (max > XNET_CFG_RX_BATCH) {
+        max = XNET_CFG_RX_BATCH;
+    }
+
+    do {
+        count = tpacket_device_read_batch(tpacket, frames, sizes, timestamps, csums, max);
+        for (uint32_t i = 0; i < count; i++) {
+            xnet_packet_t * r_packet = &packets[n];
+
+            if (sizes[i] > XNET_CFG_PACKET_MAX_SIZE) {
+                continue;
+            }
+
+            r_packet->size = (uint16_t)sizes[i];
+            r_packet->data = (uint8_t *)frames[i];
+            r_packet->rx_ts_ns = timestamps[i];
+            r_packet->flags = tpacket_csum_flags(csums[i]);
+            n++;
+        }
+    } while ((n == 0) && (count > 0));
+
+    return n;
+}
+
+/**
+ * 协议栈已处理完借出的帧，块已全部取完时归还给内核
+ * @param packets 数据包数组
+ * @param count 数量
+ */
+static void tpacket_driver_release (xnet_packet_t * packets, uint16_t count) {
+    tpacket_device_release(tpacket);
+}
+
+/**
+ * 等待接收环中有帧可读
+ * @param timeout_ms 最长等待时间
+ * @return 0 - 有数据包，其它 - 超时
+ */
+static xnet_err_t tpacket_driver_wait (uint32_t timeout_ms) {
+    return tpacket_device_wait(tpacket, (int)timeout_ms) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 取出一个内核回报的软件发送时间戳
+ * @param frame 已发出的帧
+ * @param size 帧长度
+ * @param timestamp 帧离开网卡驱动的时间
+ * @return 0 - 取到一个，其它 - 没有
+ */
+static xnet_err_t tpacket_driver_tx_timestamp (const uint8_t ** frame, uint16_t * size, uint64_t * timestamp) {
+    uint32_t length = sizeof(stamp_frame);
+
+    if (!tpacket_device_tx_timestamp(tpacket, stamp_frame, &length, timestamp)) {
+        return XNET_ERR_IO;
+    }
+
+    *frame = stamp_frame;
+    *size = (uint16_t)((length > sizeof(stamp_frame)) ? sizeof(stamp_frame) : length);
+    return XNET_ERR_OK;
+}
+
+/**
+ * 读取内核的接收与丢帧统计，接收环满时内核丢帧
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tpacket_driver_stats (xnet_driver_stats_t * stats) {
+    if (tpacket_device_stats(tpacket, &stats->recv, &stats->drop, &stats->filtered) != 0) {
+        return XNET_ERR_IO;
+    }
+
+    stats->ifdrop = 0;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 启动接收线程，接收环中的帧通过 handler 交给协议栈
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tpacket_driver_start_rx (irq_handler_t handler, void * arg) {
+    return tpacket_device_start_rx(tpacket, handler, arg) ? XNET_ERR_IO : XNET_ERR_OK;
+}
+
+/**
+ * 在内核中安装协议栈给出的接收过滤器
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t tpacket_driver_set_filter (const net_filter_t * filter) {
+    return tpacket_device_set_filter(tpacket, filter) ? XNET_ERR_IO : XNET_ERR_OK;
+}
+
+/**
+ * Linux AF_PACKET TPACKET_V3 内存映射环驱动
+ */
+const xnet_driver_ops_t xnet_driver_tpacket = {
+    .name = "tpacket",
+    .caps = XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_ZERO_COPY | XNET_DRIVER_CAP_WAIT | XNET_DRIVER_CAP_RX_TIMESTAMP
+            | XNET_DRIVER_CAP_TX_TIMESTAMP | XNET_DRIVER_CAP_IRQ | XNET_DRIVER_CAP_RX_CSUM,
+    .open = tpacket_driver_open,
+    .send = tpacket_driver_send,
+    .read = tpacket_driver_read,
+    .read_batch = tpacket_driver_read_batch,
+    .flush = tpacket_driver_flush,
+    .release = tpacket_driver_release,
+    .wait = tpacket_driver_wait,
+    .tx_timestamp = tpacket_driver_tx_timestamp,
+    .stats = tpacket_driver_stats,
+    .start_rx = tpacket_driver_start_rx,
+    .set_filter = tpacket_driver_set_filter,
+};
+
+#endif
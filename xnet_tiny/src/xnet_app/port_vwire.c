@@ -0,0 +1,150 @@
+#if defined(NET_DRIVER_VWIRE)
+
+#include <string.h>
+#include <stdlib.h>
+#include "vwire_device.h"
+#include "xnet_tiny.h"
+
+static vwire_end_t * vwire;
+static uint32_t rx_taken;                   // 已借给协议栈、尚未归还的帧数
+static uint8_t rx_csum_flags;               // 环境变量 XNET_VWIRE_CSUM_SKIP 存在时为 XNET_PACKET_CSUM_LOCAL
+static void vwire_driver_release (xnet_packet_t * packets, uint16_t count);
+
+// 协议栈接在虚拟线缆的 0 号端，测试程序打开同名线缆即得到对端
+static const char * wire_name = "vwire0";
+static const char my_mac_addr[] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+
+/**
+ * 初始化网络驱动
+ * @return 0成功，其它失败
+ */
+static xnet_err_t vwire_driver_open (uint8_t * mac_addr) {
+    memcpy(mac_addr, my_mac_addr, sizeof(my_mac_addr));
+    // 缺省照常验证校验和，与真实网卡上的处理开销可比；设置后跳过，只测协议栈其余部分
+    rx_csum_flags = getenv("XNET_VWIRE_CSUM_SKIP") ? XNET_PACKET_CSUM_LOCAL : 0;
+    vwire = vwire_device_open(wire_name);
+    if (vwire == (vwire_end_t *)0) {
+        exit(-1);
+    }
+    return XNET_ERR_OK;
+}
+
+/**
+ * 发送数据：直接放入对端的接收环
+ * @param frame 数据起始地址
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t vwire_driver_send (xnet_packet_t * packet) {
+    return vwire_device_send(vwire, packet->data, packet->size) ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 帧放入环中即对对端可见，无需提交
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t vwire_driver_flush (void) {
+    return XNET_ERR_OK;
+}
+
+/**
+ * 读取数据：数据包直接指向环中的帧，下一次读取时归还
+ * @param frame 数据存储位置
+ * @param size 数据长度
+ * @return 0 - 成功，其它失败
+ */
+static xnet_err_t vwire_driver_read (xnet_packet_t ** packet) {
+    const uint8_t * frame;
+    uint32_t size;
+
+    vwire_driver_release((xnet_packet_t *)0, 0);
+    if (vwire_device_read_batch(vwire, &frame, &size, 1) == 0) {
+        return XNET_ERR_IO;
+    }
+
+    rx_taken = 1;
+    if (size > XNET_CFG_PACKET_MAX_SIZE) {
+        return XNET_ERR_IO;
+    }
+
+    *packet = xnet_alloc_for_read((uint16_t)size);
+    if (*packet == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
+    }
+    (*packet)->data = (uint8_t *)frame;
+    (*packet)->flags = rx_csum_flags;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 批量读取数据：数据包直接指向环中的帧，不做拷贝。
+ * 帧只在进程内存中传递，不经过线路，设置 XNET_VWIRE_CSUM_SKIP 时标记为未经过线路，各层都不验证校验和。
+ * 一批帧全部因超长被丢弃时归还后接着读，返回 0 只表示环已空
+ * @param packets 数据包数组
+ * @param max 最多读取的数量
+ * @return 读到的数据包数量
+ */
+static uint16_t vwire_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    const uint8_t * frames[XNET_CFG_RX_BATCH];
+    uint32_t sizes[XNET_CFG_RX_BATCH];
+    uint16_t n = 0;
+
+    if (max > XNET_CFG_RX_BATCH) {
+        max = XNET_CFG_RX_BATCH;
+    }
+
+    do {
+        vwire_driver_release((xnet_packet_t *)0, 0);
+        rx_taken = vwire_device_read_batch(vwire, frames, sizes, max);
+        for (uint32_t i = 0; i < rx_taken; i++) {
+            if (sizes[i] > XNET_CFG_PACKET_MAX_SIZE) {
+                continue;
+            }
+
+            packets[n].data = (uint8_t *)frames[i];
+            packets[n].size = (uint16_t)sizes[i];
+            packets[n].flags = rx_csum_flags;
+            n++;
+        }
+    } while ((n == 0) && (rx_taken > 0));
+
+    return n;
+}
+
+/**
+ * 协议栈已处理完借出的帧，槽位还给对端
+ * @param packets 数据包数组
+ * @param count 数量
+ */
+static void vwire_driver_release (xnet_packet_t * packets, uint16_t count) {
+    if (rx_taken) {
+        vwire_device_release(vwire, rx_taken);
+        rx_taken = 0;
+    }
+}
+
+/**
+ * 对端通常与协议栈在同一线程中，没有可等待的对象，直接返回
+ * @param timeout_ms 最长等待时间
+ * @return 0 - 有数据包，其它 - 没有
+ */
+static xnet_err_t vwire_driver_wait (uint32_t timeout_ms) {
+    return XNET_ERR_OK;
+}
+
+/**
+ * 进程内虚拟线缆驱动
+ */
+const xnet_driver_ops_t xnet_driver_vwire = {
+    .name = "vwire",
+    .caps = XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_ZERO_COPY | XNET_DRIVER_CAP_RX_CSUM,
+    .open = vwire_driver_open,
+    .send = vwire_driver_send,
+    .read = vwire_driver_read,
+    .read_batch = vwire_driver_read_batch,
+    .flush = vwire_driver_flush,
+    .release = vwire_driver_release,
+    .wait = vwire_driver_wait,
+};
+
+#endif
@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#endif
+#include "spsc_ring.h"
+#include "xnet_tiny.h"
+
+/**
+ * 网卡驱动注册表
+ * 编译进程序的驱动都列在这里，由 CMake 中的 XNET_DRIVERS 决定。运行时用 xnet_driver_select()
+ * 或环境变量 XNET_DRIVER 按名称选择，未选择时使用列表中的第一个
+ */
+extern const xnet_driver_ops_t xnet_driver_pcap;
+extern const xnet_driver_ops_t xnet_driver_tpacket;
+extern const xnet_driver_ops_t xnet_driver_tap;
+extern const xnet_driver_ops_t xnet_driver_vwire;
+extern const xnet_driver_ops_t xnet_driver_savefile;
+extern const xnet_driver_ops_t xnet_driver_enc28j60;
+
+static const xnet_driver_ops_t * const driver_table[] = {
+#if defined(NET_DRIVER_TPACKET)
+        &xnet_driver_tpacket,
+#endif
+#if defined(NET_DRIVER_PCAP)
+        &xnet_driver_pcap,
+#endif
+#if defined(NET_DRIVER_TAP)
+        &xnet_driver_tap,
+#endif
+#if defined(NET_DRIVER_VWIRE)
+        &xnet_driver_vwire,
+#endif
+#if defined(NET_DRIVER_SAVEFILE)
+        &xnet_driver_savefile,
+#endif
+#if defined(NET_DRIVER_ENC28J60)
+        &xnet_driver_enc28j60,
+#endif
+        (const xnet_driver_ops_t *)0,
+};
+
+static const xnet_driver_ops_t * driver;        // 当前使用的驱动
+static xnet_packet_t * read_packet;             // 驱动不支持批量读取时，xnet_driver_read_batch 借出的数据包
+
+/**
+ * 回调接收方式：驱动线程在 xnet_driver_irq 中把帧放入 irq_ring，协议栈线程从中取出。
+ * 槽数据区的前 8 字节为接收时间戳，其后为帧数据，帧中的 IP 头按 4 字节对齐。协议栈等待时置 irq_waiting，
+ * 驱动线程放入帧后看到它才发出唤醒信号，没有等待者时不产生系统调用
+ */
+static xnet_rx_mode_t rx_mode = XNET_RX_POLL;
+static spsc_ring_t irq_ring;
+static volatile uint32_t irq_waiting;          // 协议栈线程正在等待唤醒
+static volatile uint32_t irq_drops;            // 队列满丢弃的帧数，只由驱动线程修改
+#if defined(_WIN32)
+static HANDLE irq_event;
+#define irq_fence()             MemoryBarrier()
+#else
+static int irq_event = -1;
+#define irq_fence()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+/**
+ * 取第 index 个编译进来的驱动，用于列出可用的驱动
+ * @return 驱动，超出范围时返回 0
+ */
+const xnet_driver_ops_t * xnet_driver_get (int index) {
+    if ((index < 0) || (index >= (int)(sizeof(driver_table) / sizeof(driver_table[0])))) {
+        return (const xnet_driver_ops_t *)0;
+    }
+    return driver_table[index];
+}
+
+/**
+ * 按名称查找驱动
+ * @return 驱动，未编译进来时返回 0
+ */
+const xnet_driver_ops_t * xnet_driver_find (const char * name) {
+    for (int i = 0; driver_table[i]; i++) {
+        if (strcmp(driver_table[i]->name, name) == 0) {
+            return driver_table[i];
+        }
+    }
+    return (const xnet_driver_ops_t *)0;
+}
+
+/**
+ * 选择所用的驱动，须在 xnet_init() 之前调用
+ * @param name 驱动名称，为 0 时使用第一个编译进来的驱动
+ * @return 0 - 成功，其它 - 没有该驱动
+ */
+xnet_err_t xnet_driver_select (const char * name) {
+    const xnet_driver_ops_t * ops = name ? xnet_driver_find(name) : driver_table[0];
+
+    if (ops == (const xnet_driver_ops_t *)0) {
+        fprintf(stderr, "driver: %s not built in, available:", name ? name : "(default)");
+        for (int i = 0; driver_table[i]; i++) {
+            fprintf(stderr, " %s", driver_table[i]->name);
+        }
+        fprintf(stderr, "\n");
+        return XNET_ERR_IO;
+    }
+
+    driver = ops;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 当前使用的驱动
+ */
+const xnet_driver_ops_t * xnet_driver_current (void) {
+    return driver;
+}
+
+/**
+ * 选择接收方式，须在 xnet_init() 之前调用
+ * 驱动不支持接收线程时，打开驱动时退回查询方式
+ */
+xnet_err_t xnet_driver_set_rx_mode (xnet_rx_mode_t mode) {
+    rx_mode = mode;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 当前生效的驱动能力：回调接收方式下，帧在驱动线程中收到时打上时间戳，
+ * 成批借给协议栈，协议栈可阻塞等待唤醒
+ */
+uint32_t xnet_driver_caps (void) {
+    // 接收队列中只有时间戳，不带校验和状态
+    if (rx_mode == XNET_RX_IRQ) {
+        return (driver->caps & ~XNET_DRIVER_CAP_RX_CSUM) | XNET_DRIVER_CAP_BATCH | XNET_DRIVER_CAP_ZERO_COPY
+               | XNET_DRIVER_CAP_WAIT | XNET_DRIVER_CAP_RX_TIMESTAMP;
+    }
+    return driver->caps;
+}
+
+/**
+ * 驱动线程收到一帧：放入接收队列，协议栈正在等待时唤醒它
+ */
+static void xnet_driver_irq (void * arg, uint8_t is_rx, const uint8_t * data, uint32_t size) {
+    uint64_t timestamp;
+    uint8_t * slot;
+
+    if (!is_rx || (size > XNET_CFG_PACKET_MAX_SIZE)) {
+        return;
+    }
+
+    timestamp = xnet_time_ns();
+    slot = spsc_ring_reserve(&irq_ring);
+    if (slot == (uint8_t *)0) {
+        irq_drops++;
+        return;
+    }
+    memcpy(slot, &timestamp, sizeof(timestamp));
+    memcpy(slot + sizeof(timestamp), data, size);
+    spsc_ring_commit(&irq_ring, (uint32_t)(sizeof(timestamp) + size));
+
+    // 先让帧可见再检查等待标志，与 xnet_driver_irq_wait 中的顺序相反，两边至少有一方能看到对方
+    irq_fence();
+    if (irq_waiting) {
+#if defined(_WIN32)
+        SetEvent(irq_event);
+#else
+        uint64_t one = 1;
+        (void)write(irq_event, &one, sizeof(one));
+#endif
+    }
+}
+
+/**
+ * 创建接收队列与唤醒信号，启动驱动的接收线程
+ * @return 0 - 成功，其它 - 失败，仍使用查询方式
+ */
+static xnet_err_t xnet_driver_irq_start (void) {
+    if (driver->start_rx == 0) {
+        printf("driver: %s has no rx thread, polling instead\n", driver->name);
+        return XNET_ERR_IO;
+    }
+
+    if (spsc_ring_init(&irq_ring, XNET_CFG_IRQ_RING_SIZE, sizeof(uint64_t) + XNET_CFG_PACKET_MAX_SIZE) != 0) {
+        fprintf(stderr, "driver: alloc rx queue failed\n");
+        return XNET_ERR_IO;
+    }
+#if defined(_WIN32)
+    irq_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (irq_event == NULL) {
+#else
+    irq_event = eventfd(0, EFD_NONBLOCK);
+    if (irq_event < 0) {
+#endif
+        fprintf(stderr, "driver: create rx event failed\n");
+        spsc_ring_free(&irq_ring);
+        return XNET_ERR_IO;
+    }
+
+    return driver->start_rx(xnet_driver_irq, (void *)0);
+}
+
+/**
+ * 等待驱动线程放入新的帧
+ * @return 0 - 队列中有帧，其它 - 超时
+ */
+static xnet_err_t xnet_driver_irq_wait (uint32_t timeout_ms) {
+    int ready;
+
+    irq_waiting = 1;
+    irq_fence();
+    ready = spsc_ring_count(&irq_ring) > 0;
+    if (!ready) {
+#if defined(_WIN32)
+        WaitForSingleObject(irq_event, timeout_ms);
+#else
+        struct pollfd pfd;
+        uint64_t count;
+
+        pfd.fd = irq_event;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, (int)timeout_ms) > 0) {
+            (void)read(irq_event, &count, sizeof(count));
+        }
+#endif
+        ready = spsc_ring_count(&irq_ring) > 0;
+    }
+    irq_waiting = 0;
+    return ready ? XNET_ERR_OK : XNET_ERR_IO;
+}
+
+/**
+ * 打开驱动：未选择驱动时，先按环境变量 XNET_DRIVER 选择
+ * @return 0成功，其它失败
+ */
+xnet_err_t xnet_driver_open (uint8_t * mac_addr) {
+    xnet_err_t err;
+
+    if ((driver == (const xnet_driver_ops_t *)0) && (xnet_driver_select(getenv("XNET_DRIVER")) != XNET_ERR_OK)) {
+        exit(-1);
+    }
+
+    err = driver->open(mac_addr);
+    if ((err == XNET_ERR_OK) && (rx_mode == XNET_RX_IRQ) && (xnet_driver_irq_start() != XNET_ERR_OK)) {
+        rx_mode = XNET_RX_POLL;
+    }
+
+    printf("driver: %s%s%s%s%s%s%s%s\n", driver->name,
+           (driver->caps & XNET_DRIVER_CAP_BATCH) ? " batch" : "",
+           (driver->caps & XNET_DRIVER_CAP_ZERO_COPY) ? " zero-copy" : "",
+           (driver->caps & XNET_DRIVER_CAP_WAIT) ? " wait" : "",
+           (driver->caps & XNET_DRIVER_CAP_RX_TIMESTAMP) ? " rx-timestamp" : "",
+           (driver->caps & XNET_DRIVER_CAP_TX_TIMESTAMP) ? " tx-timestamp" : "",
+           (xnet_driver_caps() & XNET_DRIVER_CAP_RX_CSUM) ? " rx-csum" : "",
+           (rx_mode == XNET_RX_IRQ) ? " irq" : "");
+    return err;
+}
+
+xnet_err_t xnet_driver_send (xnet_packet_t * packet) {
+    return driver->send(packet);
+}
+
+/**
+ * 读取一帧；回调接收方式下从接收队列中拷贝出来。读到的数据包由调用者用 xnet_free 释放
+ */
+xnet_err_t xnet_driver_read (xnet_packet_t ** packet) {
+    if (rx_mode == XNET_RX_IRQ) {
+        const uint8_t * slot;
+        uint32_t length;
+
+        if (spsc_ring_count(&irq_ring) == 0) {
+            return XNET_ERR_IO;
+        }
+
+        slot = spsc_ring_peek(&irq_ring, 0, &length);
+        *packet = xnet_alloc_for_read((uint16_t)(length - sizeof(uint64_t)));
+        if (*packet == (xnet_packet_t *)0) {
+            return XNET_ERR_IO;
+        }
+        memcpy(&(*packet)->rx_ts_ns, slot, sizeof(uint64_t));
+        memcpy((*packet)->data, slot + sizeof(uint64_t), (*packet)->size);
+        spsc_ring_pop(&irq_ring, 1);
+        return XNET_ERR_OK;
+    }
+
+    return driver->read(packet);
+}
+
+/**
+ * 批量读取；驱动不支持时每次读出一帧，数据包指向驱动读取的缓冲区，xnet_driver_release 时释放。
+ * 回调接收方式下数据包直接指向接收队列中的槽，xnet_driver_release 时才移出
+ */
+uint16_t xnet_driver_read_batch (xnet_packet_t * packets, uint16_t max) {
+    if (rx_mode == XNET_RX_IRQ) {
+        uint32_t count = spsc_ring_count(&irq_ring);
+
+        if (count > max) {
+            count = max;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t length;
+            const uint8_t * slot = spsc_ring_peek(&irq_ring, i, &length);
+
+            memcpy(&packets[i].rx_ts_ns, slot, sizeof(uint64_t));
+            packets[i].data = (uint8_t *)slot + sizeof(uint64_t);
+            packets[i].size = (uint16_t)(length - sizeof(uint64_t));
+        }
+        return (uint16_t)count;
+    }
+
+    if (driver->read_batch) {
+        return driver->read_batch(packets, max);
+    }
+
+    if ((max == 0) || (driver->read(&read_packet) != XNET_ERR_OK)) {
+        return 0;
+    }
+    packets[0].data = read_packet->data;
+    packets[0].size = read_packet->size;
+    packets[0].flags = read_packet->flags;
+    packets[0].rx_ts_ns = read_packet->rx_ts_ns;
+    return 1;
+}
+
+xnet_err_t xnet_driver_flush (void) {
+    return driver->flush ? driver->flush() : XNET_ERR_OK;
+}
+
+void xnet_driver_release (xnet_packet_t * packets, uint16_t count) {
+    if (rx_mode == XNET_RX_IRQ) {
+        spsc_ring_pop(&irq_ring, count);
+        return;
+    }
+
+    if (driver->release) {
+        driver->release(packets, count);
+    }
+    if (read_packet) {
+        xnet_free(read_packet);
+        read_packet = (xnet_packet_t *)0;
+    }
+}
+
+/**
+ * 等待数据包到来；驱动不支持时立即返回，由调用者继续轮询。
+ * 回调接收方式下等待驱动线程的唤醒
+ */
+xnet_err_t xnet_driver_wait (uint32_t timeout_ms) {
+    if (rx_mode == XNET_RX_IRQ) {
+        return xnet_driver_irq_wait(timeout_ms);
+    }
+    return driver->wait ? driver->wait(timeout_ms) : XNET_ERR_OK;
+}
+
+/**
+ * 取出一个驱动回报的发送时间戳；驱动不支持时总是返回失败，由协议栈使用交给驱动后读取的时钟
+ * @param frame 已发出的帧，在下一次调用之前有效
+ * @param size 帧长度
+ * @param timestamp 帧离开驱动的时间（ns，墙上时间）
+ * @return 0 - 取到一个，其它 - 没有
+ */
+xnet_err_t xnet_driver_tx_timestamp (const uint8_t ** frame, uint16_t * size, uint64_t * timestamp) {
+    return driver->tx_timestamp ? driver->tx_timestamp(frame, size, timestamp) : XNET_ERR_IO;
+}
+
+/**
+ * 按协议栈的地址与启用的协议更换驱动的接收过滤器；驱动不支持时返回失败，由协议栈自己过滤
+ */
+xnet_err_t xnet_driver_set_filter (const net_filter_t * filter) {
+    return driver->set_filter ? driver->set_filter(filter) : XNET_ERR_IO;
+}
+
+/**
+ * 读取驱动及内核的接收统计；驱动不支持且不在回调接收方式下时返回失败
+ */
+xnet_err_t xnet_driver_stats (xnet_driver_stats_t * stats) {
+    xnet_err_t err = XNET_ERR_IO;
+
+    memset(stats, 0, sizeof(xnet_driver_stats_t));
+    if (driver->stats) {
+        err = driver->stats(stats);
+    }
+    if (rx_mode == XNET_RX_IRQ) {
+        stats->irq_drop = irq_drops;
+        err = XNET_ERR_OK;
+    }
+    return err;
+}
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "spsc_ring.h"
+#include "xnet_tiny.h"
+#include "xnet_capture.h"
+
+#if XNET_CFG_CAPTURE
+
+#define NS_PER_SEC              1000000000ULL
+#define CAPTURE_IDLE_MS         1           // 环为空时写线程的休眠时间
+#define CAPTURE_LINKTYPE        1           // 以太网
+
+/**
+ * 环中每个槽的内容：帧头 + 帧数据
+ * 槽的数据区只保证 2 字节对齐，帧头用 memcpy 整体写入、读出，不在槽中直接访问
+ */
+typedef struct _capture_rec_t {
+    uint64_t ts_ns;                         // 抓到时的时间，自 1970 年起的纳秒数
+    uint16_t size;
+    uint8_t dir;
+} capture_rec_t;
+
+static spsc_ring_t capture_ring;
+static FILE * capture_file;
+static xnet_capture_format_t capture_format;
+static volatile int capture_running;        // 为 0 时写线程写完环中剩余的帧后退出
+static int capture_opened;                  // 已注册 atexit
+static xnet_capture_stats_t capture_stats;
+#if defined(_WIN32)
+static HANDLE capture_thread;
+#else
+static pthread_t capture_thread;
+#endif
+
+static void capture_sleep_ms(uint32_t ms) {
+#if defined(_WIN32)
+    Sleep(ms);
+#else
+    usleep(ms * 1000);
+#endif
+}
+
+static int capture_put(const void * data, size_t size) {
+    return fwrite(data, 1, size, capture_file) == size ? 0 : -1;
+}
+
+static int capture_put32(uint32_t v) {
+    return capture_put(&v, sizeof(v));
+}
+
+/**
+ * 写文件头：pcap 为全局头，pcapng 为 SHB + IDB
+ */
+static int capture_write_header(void) {
+    if (capture_format == XNET_CAPTURE_PCAP) {
+        uint16_t version[2] = {2, 4};
+
+        return capture_put32(0xA1B23C4D)            // 纳秒精度
+            || capture_put(version, sizeof(version))
+            || capture_put32(0) || capture_put32(0)
+            || capture_put32(XNET_CFG_PACKET_MAX_SIZE)
+            || capture_put32(CAPTURE_LINKTYPE);
+    } else {
+        uint16_t version[2] = {1, 0};
+        uint16_t idb[4] = {CAPTURE_LINKTYPE, 0, 9, 1};    // linktype, reserved, if_tsresol, 长度 1
+        uint8_t tsresol[4] = {9, 0, 0, 0};                // 10^-9 秒
+
+        // Section Header Block
+        if (capture_put32(0x0A0D0D0A) || capture_put32(28) || capture_put32(0x1A2B3C4D)
+            || capture_put(version, sizeof(version))
+            || capture_put32(0xFFFFFFFF) || capture_put32(0xFFFFFFFF)
+            || capture_put32(28)) {
+            return -1;
+        }
+
+        // Interface Description Block
+        return capture_put32(1) || capture_put32(32)
+            || capture_put(idb, 4) || capture_put32(XNET_CFG_PACKET_MAX_SIZE)
+            || capture_put(&idb[2], 4) || capture_put(tsresol, sizeof(tsresol))
+            || capture_put32(0)                           // opt_endofopt
+            || capture_put32(32);
+    }
+}
+
+/**
+ * 写一帧：pcap 为记录头 + 数据，pcapng 为带 epb_flags 的 Enhanced Packet Block
+ */
+static int capture_write_frame(const capture_rec_t * rec, const uint8_t * data) {
+    if (capture_format == XNET_CAPTURE_PCAP) {
+        return capture_put32((uint32_t)(rec->ts_ns / NS_PER_SEC))
+            || capture_put32((uint32_t)(rec->ts_ns % NS_PER_SEC))
+            || capture_put32(rec->size) || capture_put32(rec->size)
+            || capture_put(data, rec->size);
+    } else {
+        static const uint8_t pad[4] = {0};
+        uint32_t padded = (rec->size + 3) & ~3u;
+        uint32_t total = 32 + padded + 12;
+        uint16_t flags_opt[2] = {2, 4};                   // epb_flags，长度 4
+
+        return capture_put32(6) || capture_put32(total) || capture_put32(0)
+            || capture_put32((uint32_t)(rec->ts_ns >> 32)) || capture_put32((uint32_t)rec->ts_ns)
+            || capture_put32(rec->size) || capture_put32(rec->size)
+            || capture_put(data, rec->size) || capture_put(pad, padded - rec->size)
+            || capture_put(flags_opt, sizeof(flags_opt)) || capture_put32(rec->dir)
+            || capture_put32(0)                           // opt_endofopt
+            || capture_put32(total);
+    }
+}
+
+/**
+ * 写线程：不断取出环中的帧写入文件，空闲时把缓冲写盘
+ */
+#if defined(_WIN32)
+static DWORD WINAPI capture_writer(LPVOID arg) {
+#else
+static void * capture_writer(void * arg) {
+#endif
+    while (1) {
+        uint32_t count = spsc_ring_count(&capture_ring);
+
+        if (count == 0) {
+            if (!capture_running) {
+                break;
+            }
+            fflush(capture_file);
+            capture_sleep_ms(CAPTURE_IDLE_MS);
+            continue;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t length;
+            const uint8_t * slot = spsc_ring_peek(&capture_ring, i, &length);
+            capture_rec_t rec;
+
+            memcpy(&rec, slot, sizeof(capture_rec_t));
+            if (capture_write_frame(&rec, slot + sizeof(capture_rec_t)) == 0) {
+                capture_stats.written++;
+                capture_stats.bytes += rec.size;
+            } else {
+                capture_stats.write_errors++;
+            }
+        }
+        spsc_ring_pop(&capture_ring, count);
+    }
+
+    fflush(capture_file);
+    return 0;
+}
+
+/**
+ * 开始抓包，程序退出时自动停止
+ * @param path 输出文件
+ * @param format 文件格式
+ * @return 0 - 成功，其它失败
+ */
+int xnet_capture_open(const char * path, xnet_capture_format_t format) {
+    if (capture_running) {
+        return -1;
+    }
+
+    if (spsc_ring_init(&capture_ring, XNET_CFG_CAPTURE_RING_SIZE,
+                       sizeof(capture_rec_t) + XNET_CFG_PACKET_MAX_SIZE) < 0) {
+        fprintf(stderr, "capture: alloc ring failed\n");
+        return -1;
+    }
+
+    capture_file = fopen(path, "wb");
+    if (capture_file == (FILE *)0) {
+        fprintf(stderr, "capture: create %s failed\n", path);
+        spsc_ring_free(&capture_ring);
+        return -1;
+    }
+
+    capture_format = format;
+    memset(&capture_stats, 0, sizeof(capture_stats));
+    if (capture_write_header() != 0) {
+        fprintf(stderr, "capture: write %s header failed\n", path);
+        fclose(capture_file);
+        spsc_ring_free(&capture_ring);
+        return -1;
+    }
+
+    capture_running = 1;
+#if defined(_WIN32)
+    capture_thread = CreateThread(NULL, 0, capture_writer, NULL, 0, NULL);
+    if (capture_thread == NULL) {
+#else
+    if (pthread_create(&capture_thread, NULL, capture_writer, NULL) != 0) {
+#endif
+        fprintf(stderr, "capture: create writer thread failed\n");
+        capture_running = 0;
+        fclose(capture_file);
+        spsc_ring_free(&capture_ring);
+        return -1;
+    }
+
+    if (!capture_opened++) {
+        atexit(xnet_capture_close);
+    }
+    return 0;
+}
+
+/**
+ * 停止抓包：等写线程写完环中剩余的帧，关闭文件并输出统计
+ */
+void xnet_capture_close(void) {
+    if (!capture_running) {
+        return;
+    }
+
+    capture_running = 0;
+#if defined(_WIN32)
+    WaitForSingleObject(capture_thread, INFINITE);
+    CloseHandle(capture_thread);
+#else
+    pthread_join(capture_thread, NULL);
+#endif
+    fclose(capture_file);
+    spsc_ring_free(&capture_ring);
+
+    fprintf(stderr, "capture: %u frames captured, %u written, %u dropped (ring full), %u write errors\n",
+            capture_stats.captured, capture_stats.written, capture_stats.dropped, capture_stats.write_errors);
+}
+
+/**
+ * 抓取一帧：复制进环后立即返回，环满时丢弃
+ * @param dir 收发方向
+ * @param data 帧起始地址
+ * @param size 帧长度
+ * @param ts_ns 协议栈给出的时间戳（xnet_time_ns() 的时基），与它报告的 RTT、时延一致
+ */
+void xnet_capture_frame(xnet_capture_dir_t dir, const uint8_t * data, uint16_t size, uint64_t ts_ns) {
+    capture_rec_t rec;
+    uint8_t * slot;
+
+    if (!capture_running) {
+        return;
+    }
+
+    slot = spsc_ring_reserve(&capture_ring);
+    if (slot == (uint8_t *)0) {
+        capture_stats.dropped++;
+        return;
+    }
+
+    rec.ts_ns = ts_ns;
+    rec.size = size > XNET_CFG_PACKET_MAX_SIZE ? XNET_CFG_PACKET_MAX_SIZE : size;
+    rec.dir = (uint8_t)dir;
+    memcpy(slot, &rec, sizeof(capture_rec_t));
+    memcpy(slot + sizeof(capture_rec_t), data, rec.size);
+    spsc_ring_commit(&capture_ring, sizeof(capture_rec_t) + rec.size);
+    capture_stats.captured++;
+}
+
+/**
+ * 获取抓包统计
+ */
+const xnet_capture_stats_t * xnet_capture_get_stats(void) {
+    return &capture_stats;
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef XNET_CAPTURE_H
+#define XNET_CAPTURE_H
+
+#include <stdint.h>
+#include "xnet_cfg.h"
+
+/**
+ * 协议栈内置抓包
+ * 收发的帧在驱动边界被复制进无锁环，由后台线程写入 pcap/pcapng 文件，
+ * 收发路径上不做任何磁盘 I/O，环满时丢弃并计数
+ */
+
+typedef enum _xnet_capture_dir_t {
+    XNET_CAPTURE_RX = 1,                           // 从驱动收到
+    XNET_CAPTURE_TX = 2,                           // 交给驱动发送
+} xnet_capture_dir_t;
+
+typedef enum _xnet_capture_format_t {
+    XNET_CAPTURE_PCAP,                             // 经典 pcap，纳秒时间戳
+    XNET_CAPTURE_PCAPNG,                           // pcapng，带收发方向标记
+} xnet_capture_format_t;
+
+/**
+ * 抓包统计
+ */
+typedef struct _xnet_capture_stats_t {
+    uint32_t captured;                             // 放入环中的帧数
+    uint32_t dropped;                              // 环满丢弃的帧数
+    uint32_t written;                              // 已写入文件的帧数
+    uint32_t write_errors;                         // 写文件失败的帧数
+    uint64_t bytes;                                // 已写入文件的字节数
+} xnet_capture_stats_t;
+
+#if XNET_CFG_CAPTURE
+int xnet_capture_open(const char * path, xnet_capture_format_t format);
+void xnet_capture_close(void);
+void xnet_capture_frame(xnet_capture_dir_t dir, const uint8_t * data, uint16_t size, uint64_t ts_ns);
+const xnet_capture_stats_t * xnet_capture_get_stats(void);
+#else
+// 未编译抓包：打开总是失败，收发路径上的调用不产生代码
+static inline int xnet_capture_open(const char * path, xnet_capture_format_t format) {
+    return -1;
+}
+#define xnet_capture_close()                    ((void)0)
+#define xnet_capture_frame(dir, data, size, ts_ns)  ((void)0)
+#endif
+
+#endif // XNET_CAPTURE_H
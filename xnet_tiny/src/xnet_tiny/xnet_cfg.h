@@ -0,0 +1,117 @@
+#ifndef XNET_CFG_H
+#define XNET_CFG_H
+
+/**
+ * 协议栈的编译配置：功能开关与各个池、表、队列的大小
+ * 每一项都可以用编译选项 -D 覆盖，或写进 XNET_CFG_FILE 指定的头文件中统一修改，
+ * 例如 xnet_cfg_tiny.h 是只应答 ARP 与 ping 的最小配置
+ */
+#if defined(XNET_CFG_FILE)
+#include XNET_CFG_FILE
+#endif
+
+// ping 客户端：xicmp_ping()、探测包的发送时间记录与 RTT，ARP 超时时向自己生成 Host Unreachable；
+// 为 0 时仍然应答对方的 ping
+#ifndef XNET_CFG_PING
+#define XNET_CFG_PING                   1
+#endif
+
+// traceroute：逐跳探测的状态与 xicmp_traceroute_*()，依赖 XNET_CFG_PING
+#ifndef XNET_CFG_TRACEROUTE
+#define XNET_CFG_TRACEROUTE             XNET_CFG_PING
+#endif
+
+// 虚拟路由器：在平坦的网络上模拟中间路由器，回复 traceroute 前几跳的 Time Exceeded
+#ifndef XNET_CFG_VROUTER
+#define XNET_CFG_VROUTER                XNET_CFG_TRACEROUTE
+#endif
+
+// ARP 表变化、驱动丢帧等诊断信息的打印
+#ifndef XNET_CFG_DEBUG
+#define XNET_CFG_DEBUG                  1
+#endif
+
+// ARP 表每次变化后打印整张表
+#ifndef XNET_CFG_ARP_TABLE_PRINT
+#define XNET_CFG_ARP_TABLE_PRINT        XNET_CFG_DEBUG
+#endif
+
+// 内置抓包（xnet_capture.c）：后台写线程与抓包环
+#ifndef XNET_CFG_CAPTURE
+#define XNET_CFG_CAPTURE                1
+#endif
+
+// 数据包池的容量：xnet_alloc_for_send/xnet_alloc_for_read 从池中分配，用完后分配失败
+#ifndef XNET_CFG_PACKET_POOL_SIZE
+#define XNET_CFG_PACKET_POOL_SIZE       64
+#endif
+
+// 每个线程本地空闲链表一次从池中取出、或积累过多时一次还回的数据包数
+#ifndef XNET_CFG_PACKET_POOL_CACHE
+#define XNET_CFG_PACKET_POOL_CACHE      8
+#endif
+
+// CPU 缓存行大小，数据包的 payload 按此对齐，不能小于 4
+#ifndef XNET_CFG_CACHE_LINE
+#define XNET_CFG_CACHE_LINE             64
+#endif
+
+// 驱动一次批量读取的最大帧数（接收数组常驻内存），及每次 poll 默认最多处理的帧数
+#ifndef XNET_CFG_RX_BATCH
+#define XNET_CFG_RX_BATCH               32
+#endif
+#ifndef XNET_CFG_POLL_BUDGET
+#define XNET_CFG_POLL_BUDGET            256
+#endif
+
+// 发送队列深度：队列满时自动发送，否则在 xnet_poll() 结束或调用 xnet_flush() 时发送
+#ifndef XNET_CFG_TX_QUEUE_DEPTH
+#define XNET_CFG_TX_QUEUE_DEPTH         32
+#endif
+
+// 抓包环的槽数量（2 的幂），写线程跟不上时多出的帧被丢弃
+#ifndef XNET_CFG_CAPTURE_RING_SIZE
+#define XNET_CFG_CAPTURE_RING_SIZE      4096
+#endif
+
+// 回调接收方式下，驱动线程与协议栈之间接收队列的槽数量（2 的幂），队列满时新到的帧被丢弃
+#ifndef XNET_CFG_IRQ_RING_SIZE
+#define XNET_CFG_IRQ_RING_SIZE          1024
+#endif
+
+// 记录发送时间的 ICMP 探测包数量，回复按 id/seq 找回发送时间计算 RTT
+#ifndef XNET_CFG_PROBE_SLOTS
+#define XNET_CFG_PROBE_SLOTS            16
+#endif
+
+// ARP 表项数
+#ifndef XNET_CFG_ARP_TABLE_SIZE
+#define XNET_CFG_ARP_TABLE_SIZE         8
+#endif
+
+// 每个等待解析的 ARP 表项最多暂存的待发 IP 包数，超出时丢弃最早的一个
+#ifndef XNET_CFG_ARP_QUEUE_DEPTH
+#define XNET_CFG_ARP_QUEUE_DEPTH        4
+#endif
+
+// 每隔多少个 tick 读取一次驱动的接收统计，发现内核丢帧时给出提示
+#ifndef XNET_CFG_DRIVER_STATS_TICKS
+#define XNET_CFG_DRIVER_STATS_TICKS     10
+#endif
+
+// 忙轮询模式下连续空轮询时的最大退避（pause 指令次数），达到后改为让出 CPU
+#ifndef XNET_CFG_BUSY_BACKOFF_MAX
+#define XNET_CFG_BUSY_BACKOFF_MAX       1024
+#endif
+
+#if XNET_CFG_TRACEROUTE && !XNET_CFG_PING
+#error "XNET_CFG_TRACEROUTE needs XNET_CFG_PING"
+#endif
+#if XNET_CFG_VROUTER && !XNET_CFG_TRACEROUTE
+#error "XNET_CFG_VROUTER needs XNET_CFG_TRACEROUTE"
+#endif
+#if (XNET_CFG_PACKET_POOL_SIZE < 2) || (XNET_CFG_RX_BATCH < 1) || (XNET_CFG_ARP_TABLE_SIZE < 1) || (XNET_CFG_ARP_QUEUE_DEPTH < 1)
+#error "XNET_CFG_*: pool needs 2 packets, rx batch, arp table and arp queue at least 1"
+#endif
+
+#endif // XNET_CFG_H
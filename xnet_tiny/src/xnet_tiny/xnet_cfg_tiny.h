@@ -0,0 +1,23 @@
+#ifndef XNET_CFG_TINY_H
+#define XNET_CFG_TINY_H
+
+/**
+ * 最小配置：只应答 ARP 与 ping，用于 ENC28J60 板子（网卡缓冲区约 8KB，MCU 的 RAM 很少）
+ * 用法：cmake -DXNET_CFG_FILE=xnet_cfg_tiny.h，未列出的项仍取 xnet_cfg.h 中的缺省值
+ */
+#define XNET_CFG_PING                   0
+#define XNET_CFG_DEBUG                  0
+#define XNET_CFG_CAPTURE                0
+
+// 一次收一帧，应答与 ARP 暂存各用一个，再留一个给发送时的拼接
+#define XNET_CFG_PACKET_POOL_SIZE       4
+#define XNET_CFG_PACKET_POOL_CACHE      1
+#define XNET_CFG_CACHE_LINE             4
+#define XNET_CFG_RX_BATCH               1
+#define XNET_CFG_POLL_BUDGET            4
+#define XNET_CFG_TX_QUEUE_DEPTH         1
+#define XNET_CFG_IRQ_RING_SIZE          4
+#define XNET_CFG_ARP_TABLE_SIZE         2
+#define XNET_CFG_ARP_QUEUE_DEPTH        1
+
+#endif // XNET_CFG_TINY_H
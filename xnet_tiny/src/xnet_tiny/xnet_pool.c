@@ -0,0 +1,509 @@
+#if defined(_WIN32)
+#include <windows.h>
+#endif
+#include <string.h>
+#include "xnet_tiny.h"
+
+/**
+ * 数据包池
+ * 所有数据包预先静态分配，空闲的用 next 串成链表，分配与释放都是 O(1)，运行中不使用堆。
+ * 每个线程有自己的空闲链表，平时只在本地取放，不加锁；本地为空时一次从全局链表取一批，
+ * 本地积累过多时一次还回一批，只有这两种情况才需要获取全局链表的自旋锁。
+ * 克隆的数据包占用一个描述符，但 data 指向原包的 payload，原包的引用数归零后才还回池
+ */
+#if defined(_MSC_VER)
+#define POOL_THREAD_LOCAL           __declspec(thread)
+#define pool_atomic_add(p, v)       ((uint32_t)InterlockedExchangeAdd((volatile LONG *)(p), (LONG)(v)) + (uint32_t)(v))
+#else
+#define POOL_THREAD_LOCAL           __thread
+#define pool_atomic_add(p, v)       __atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#endif
+
+#define min(a, b)                   ((a) > (b) ? (b) : (a))
+
+/**
+ * 线程本地的空闲链表
+ */
+typedef struct _pool_cache_t {
+    xnet_packet_t * free;
+    uint32_t count;
+} pool_cache_t;
+
+static xnet_packet_t pool_packets[XNET_CFG_PACKET_POOL_SIZE];
+static xnet_packet_t * pool_free;                       // 全局空闲链表，由 pool_lock 保护
+static volatile long pool_lock;
+static int pool_ready;                                  // 全局链表已建立，第一次取用时建立
+static POOL_THREAD_LOCAL pool_cache_t pool_cache;
+static xnet_pool_stats_t pool_stats = {.size = XNET_CFG_PACKET_POOL_SIZE};
+
+static void pool_lock_acquire(void) {
+#if defined(_MSC_VER)
+    while (InterlockedExchange(&pool_lock, 1)) {
+        YieldProcessor();
+    }
+#else
+    while (__atomic_exchange_n(&pool_lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&pool_lock, __ATOMIC_RELAXED)) {
+        }
+    }
+#endif
+}
+
+static void pool_lock_release(void) {
+#if defined(_MSC_VER)
+    InterlockedExchange(&pool_lock, 0);
+#else
+    __atomic_store_n(&pool_lock, 0, __ATOMIC_RELEASE);
+#endif
+}
+
+/**
+ * 从全局链表取最多 XNET_CFG_PACKET_POOL_CACHE 个放入本地链表
+ */
+static void pool_refill(pool_cache_t * cache) {
+    pool_lock_acquire();
+    if (!pool_ready) {
+        for (int i = XNET_CFG_PACKET_POOL_SIZE - 1; i >= 0; i--) {
+            pool_packets[i].next = pool_free;
+            pool_free = &pool_packets[i];
+        }
+        pool_ready = 1;
+    }
+
+    while (pool_free && (cache->count < XNET_CFG_PACKET_POOL_CACHE)) {
+        xnet_packet_t * packet = pool_free;
+
+        pool_free = packet->next;
+        packet->next = cache->free;
+        cache->free = packet;
+        cache->count++;
+    }
+    pool_lock_release();
+}
+
+/**
+ * 把本地链表中的 count 个还回全局链表
+ */
+static void pool_drain(pool_cache_t * cache, uint32_t count) {
+    pool_lock_acquire();
+    while (cache->free && count--) {
+        xnet_packet_t * packet = cache->free;
+
+        cache->free = packet->next;
+        cache->count--;
+        packet->next = pool_free;
+        pool_free = packet;
+    }
+    pool_lock_release();
+}
+
+static void pool_update_high_water(uint32_t in_use) {
+    uint32_t high = pool_stats.high_water;
+
+    while (in_use > high) {
+#if defined(_MSC_VER)
+        uint32_t prev = (uint32_t)InterlockedCompareExchange((volatile LONG *)&pool_stats.high_water,
+                                                             (LONG)in_use, (LONG)high);
+        if (prev == high) {
+            break;
+        }
+        high = prev;
+#else
+        if (__atomic_compare_exchange_n(&pool_stats.high_water, &high, in_use, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+#endif
+    }
+}
+
+/**
+ * 从池中取一个数据包
+ * @return 数据包，池已用完时返回 0
+ */
+static xnet_packet_t * pool_alloc(void) {
+    pool_cache_t * cache = &pool_cache;
+    xnet_packet_t * packet;
+
+    if (cache->free == (xnet_packet_t *)0) {
+        pool_refill(cache);
+    }
+
+    packet = cache->free;
+    if (packet == (xnet_packet_t *)0) {
+        pool_atomic_add(&pool_stats.alloc_fail, 1);
+        return (xnet_packet_t *)0;
+    }
+
+    cache->free = packet->next;
+    cache->count--;
+    packet->next = (xnet_packet_t *)0;
+    packet->chain = (xnet_packet_t *)0;
+    packet->owner = (xnet_packet_t *)0;
+    packet->ref = 1;
+    packet->flags = 0;
+    packet->rx_ts_ns = 0;
+    pool_update_high_water(pool_atomic_add(&pool_stats.in_use, 1));
+    return packet;
+}
+
+/**
+ * 分配一个发送用的数据包，前面留出 XNET_CFG_PACKET_HEADROOM 的头部空间，其余作为尾部空间；
+ * 数据太大时头部空间相应减少
+ * @return 数据包，池已用完时返回 0
+ */
+xnet_packet_t * xnet_alloc_for_send(uint16_t data_size) {
+    xnet_packet_t * packet = pool_alloc();
+
+    if (packet) {
+        uint16_t headroom = XNET_PACKET_BUF_SIZE - data_size;
+
+        packet->data = packet->payload + min(headroom, XNET_CFG_PACKET_HEADROOM);
+        packet->size = data_size;
+    }
+    return packet;
+}
+
+/**
+ * 分配一个接收用的数据包，数据从 XNET_PACKET_PAD 处开始，帧中的 IP 头按 4 字节对齐
+ * @return 数据包，池已用完时返回 0
+ */
+xnet_packet_t * xnet_alloc_for_read(uint16_t data_size) {
+    xnet_packet_t * packet = pool_alloc();
+
+    if (packet) {
+        packet->data = xnet_packet_frame(packet);
+        packet->size = data_size;
+    }
+    return packet;
+}
+
+/**
+ * 释放一个引用，引用数归零时把数据包放回本地链表，若它引用着别的缓冲区再释放那一个
+ */
+static void pool_put(pool_cache_t * cache, xnet_packet_t * packet) {
+    while (packet && (pool_atomic_add(&packet->ref, (uint32_t)-1) == 0)) {
+        xnet_packet_t * owner = packet->owner;
+
+        packet->next = cache->free;
+        cache->free = packet;
+        cache->count++;
+        pool_atomic_add(&pool_stats.in_use, (uint32_t)-1);
+        packet = owner;
+    }
+}
+
+/**
+ * 释放数据包及其后续分段，放入当前线程的空闲链表，可以在分配它的线程之外释放；
+ * 缓冲区仍被克隆引用时，等最后一个引用释放后才真正还回池
+ * @param packet 数据包，为 0 时不做任何事
+ */
+void xnet_free(xnet_packet_t * packet) {
+    pool_cache_t * cache = &pool_cache;
+
+    while (packet) {
+        xnet_packet_t * segment = packet->chain;
+
+        pool_put(cache, packet);
+        packet = segment;
+    }
+
+    if (cache->count > 2 * XNET_CFG_PACKET_POOL_CACHE) {
+        pool_drain(cache, cache->count - XNET_CFG_PACKET_POOL_CACHE);
+    }
+}
+
+/**
+ * 把当前线程空闲链表中的数据包全部还回全局链表，使用过数据包的线程退出前调用
+ */
+void xnet_pool_flush(void) {
+    pool_cache_t * cache = &pool_cache;
+
+    if (cache->count) {
+        pool_drain(cache, cache->count);
+    }
+}
+
+/**
+ * 获取数据包池的统计
+ */
+const xnet_pool_stats_t * xnet_pool_get_stats(void) {
+    return &pool_stats;
+}
+
+/**
+ * 数据所在的缓冲区：克隆的数据包为原包的 payload
+ */
+static const xnet_packet_t * packet_buffer(const xnet_packet_t * packet) {
+    return packet->owner ? packet->owner : packet;
+}
+
+/**
+ * 数据是否在可写的缓冲区中；零拷贝接收时指向驱动的缓冲区，缓冲区被共享时其它引用者可能在用，
+ * 这两种情况下前后空间都不可用
+ * @return 可写时返回缓冲区起始地址，否则返回 0
+ */
+static const uint8_t * packet_writable(const xnet_packet_t * packet) {
+    const xnet_packet_t * buffer = packet_buffer(packet);
+
+    if ((buffer->ref > 1)
+        || (packet->data < buffer->payload)
+        || (packet->data + packet->size > buffer->payload + XNET_PACKET_BUF_SIZE)) {
+        return (const uint8_t *)0;
+    }
+    return buffer->payload;
+}
+
+/**
+ * 数据包是否在池中，只有池中的数据包可以被克隆引用
+ */
+static int pool_contains(const xnet_packet_t * packet) {
+    return (packet >= pool_packets) && (packet < pool_packets + XNET_CFG_PACKET_POOL_SIZE);
+}
+
+/**
+ * 数据前面可用于添加头部的空间
+ */
+uint16_t xnet_headroom(const xnet_packet_t * packet) {
+    const uint8_t * payload = packet_writable(packet);
+
+    return payload ? (uint16_t)(packet->data - payload) : 0;
+}
+
+/**
+ * 数据后面可用于追加数据的空间
+ */
+uint16_t xnet_tailroom(const xnet_packet_t * packet) {
+    const uint8_t * payload = packet_writable(packet);
+
+    if (payload == (const uint8_t *)0) {
+        return 0;
+    }
+    return (uint16_t)(payload + XNET_PACKET_BUF_SIZE - packet->data - packet->size);
+}
+
+/**
+ * 在空数据包的开头保留 size 字节的头部空间，只能在写入数据之前调用
+ */
+void xnet_reserve(xnet_packet_t * packet, uint16_t size) {
+    packet->data = packet->payload + min(size, XNET_PACKET_BUF_SIZE);
+    packet->size = 0;
+}
+
+/**
+ * 在数据前面添加 size 字节，用于加各层的包头
+ * @return 新的数据起始地址，头部空间不够时返回 0，数据包不变
+ */
+uint8_t * xnet_push(xnet_packet_t * packet, uint16_t size) {
+    if (xnet_headroom(packet) < size) {
+        return (uint8_t *)0;
+    }
+
+    packet->data -= size;
+    packet->size += size;
+    return packet->data;
+}
+
+/**
+ * 去掉数据前面的 size 字节，用于移除已处理的包头
+ * @return 新的数据起始地址，数据不足 size 时返回 0，数据包不变
+ */
+uint8_t * xnet_pull(xnet_packet_t * packet, uint16_t size) {
+    if (packet->size < size) {
+        return (uint8_t *)0;
+    }
+
+    packet->data += size;
+    packet->size -= size;
+    return packet->data;
+}
+
+/**
+ * 在数据后面追加 size 字节
+ * @return 追加部分的起始地址，尾部空间不够时返回 0，数据包不变
+ */
+uint8_t * xnet_put(xnet_packet_t * packet, uint16_t size) {
+    uint8_t * tail = packet->data + packet->size;
+
+    if (xnet_tailroom(packet) < size) {
+        return (uint8_t *)0;
+    }
+
+    packet->size += size;
+    return tail;
+}
+
+/**
+ * 把数据截短到 size 字节，数据本来不超过 size 时不变
+ */
+void xnet_trim(xnet_packet_t * packet, uint16_t size) {
+    packet->size = min(packet->size, size);
+}
+
+/**
+ * 把 segment（可以本身带有后续分段）接到 packet 所在链的末尾，之后由 packet 一起释放
+ */
+void xnet_chain(xnet_packet_t * packet, xnet_packet_t * segment) {
+    while (packet->chain) {
+        packet = packet->chain;
+    }
+    packet->chain = segment;
+}
+
+/**
+ * 整条链的数据总长度
+ */
+uint32_t xnet_chain_size(const xnet_packet_t * packet) {
+    uint32_t size = 0;
+
+    for (; packet; packet = packet->chain) {
+        size += packet->size;
+    }
+    return size;
+}
+
+/**
+ * 从整条链的 offset 处起复制最多 size 字节到 buf
+ * @return 实际复制的字节数
+ */
+uint32_t xnet_chain_copy(const xnet_packet_t * packet, uint32_t offset, uint8_t * buf, uint32_t size) {
+    uint32_t copied = 0;
+
+    for (; packet && (copied < size); packet = packet->chain) {
+        uint32_t count;
+
+        if (offset >= packet->size) {
+            offset -= packet->size;
+            continue;
+        }
+
+        count = min(packet->size - offset, size - copied);
+        memcpy(buf + copied, packet->data + offset, count);
+        copied += count;
+        offset = 0;
+    }
+    return copied;
+}
+
+/**
+ * 把分段或共享的数据包复制成可写的一段，交给驱动发送前使用
+ * @return 没有分段且不共享时返回 packet 本身；否则返回新分配的数据包，packet 仍由调用者释放；
+ *         总长度超过一个缓冲区或池已用完时返回 0
+ */
+xnet_packet_t * xnet_linearize(xnet_packet_t * packet) {
+    xnet_packet_t * flat;
+    uint32_t size;
+
+    if ((packet->chain == (xnet_packet_t *)0) && !xnet_shared(packet)) {
+        return packet;
+    }
+
+    size = xnet_chain_size(packet);
+    if (size > XNET_CFG_PACKET_MAX_SIZE) {
+        return (xnet_packet_t *)0;
+    }
+
+    flat = xnet_alloc_for_send((uint16_t)size);
+    if (flat) {
+        xnet_chain_copy(packet, 0, flat->data, size);
+        flat->flags = packet->flags;
+    }
+    return flat;
+}
+
+/**
+ * 缓冲区是否被多个数据包共用
+ */
+int xnet_shared(const xnet_packet_t * packet) {
+    return packet_buffer(packet)->ref > 1;
+}
+
+/**
+ * 克隆数据包（包括后续分段）：新数据包共用原包的缓冲区，不复制数据。
+ * 数据不在池中的缓冲区里时（零拷贝接收、驱动的批量接收数组）无法引用，改为复制
+ * @return 克隆的数据包，由调用者用 xnet_free 释放；池已用完时返回 0
+ */
+xnet_packet_t * xnet_clone(xnet_packet_t * packet) {
+    xnet_packet_t * head = (xnet_packet_t *)0;
+    xnet_packet_t ** tail = &head;
+
+    for (; packet; packet = packet->chain) {
+        xnet_packet_t * buffer = packet->owner ? packet->owner : packet;
+        xnet_packet_t * clone;
+
+        if (pool_contains(buffer) && (packet->data >= buffer->payload)
+            && (packet->data + packet->size <= buffer->payload + XNET_PACKET_BUF_SIZE)) {
+            clone = pool_alloc();
+            if (clone) {
+                pool_atomic_add(&buffer->ref, 1);
+                clone->owner = buffer;
+                clone->data = packet->data;
+                clone->size = packet->size;
+            }
+        } else {
+            clone = xnet_alloc_for_send(packet->size);
+            if (clone) {
+                memcpy(clone->data, packet->data, packet->size);
+            }
+        }
+
+        if (clone == (xnet_packet_t *)0) {
+            xnet_free(head);
+            return (xnet_packet_t *)0;
+        }
+
+        clone->flags = packet->flags;
+        clone->rx_ts_ns = packet->rx_ts_ns;
+        *tail = clone;
+        tail = &clone->chain;
+    }
+    return head;
+}
+
+/**
+ * 写时复制：缓冲区被共享时，把前 size 字节复制到私有的缓冲区并留出头部空间，
+ * 其余数据仍引用原缓冲区，作为后续分段接在后面。packet 本身不变，调用者照常释放
+ * @param size 要修改的包头长度，为 0 时只取得可以 push 新包头的头部空间
+ * @return 0 - 成功，其它 - 池已用完，数据包不变
+ */
+xnet_err_t xnet_unshare_header(xnet_packet_t * packet, uint16_t size) {
+    xnet_packet_t * header;
+    xnet_packet_t * rest;
+
+    if (!xnet_shared(packet)) {
+        return XNET_ERR_OK;
+    }
+
+    size = min(size, packet->size);
+    rest = pool_alloc();
+    if (rest == (xnet_packet_t *)0) {
+        return XNET_ERR_IO;
+    }
+
+    // 克隆自己的 payload 没有用到，包头直接放进去；否则包头另放一个缓冲区，packet 引用它
+    if (packet->owner) {
+        header = packet;
+        rest->owner = packet->owner;                // 把对原缓冲区的引用转给 rest
+    } else {
+        header = pool_alloc();
+        if (header == (xnet_packet_t *)0) {
+            pool_put(&pool_cache, rest);
+            return XNET_ERR_IO;
+        }
+        rest->owner = packet;
+        pool_atomic_add(&packet->ref, 1);
+    }
+    rest->data = packet->data + size;
+    rest->size = packet->size - size;
+    rest->flags = packet->flags;
+    rest->rx_ts_ns = packet->rx_ts_ns;
+    rest->chain = packet->chain;
+
+    xnet_reserve(header, XNET_CFG_PACKET_HEADROOM);
+    memcpy(header->data, rest->data - size, size);
+    packet->owner = (header == packet) ? (xnet_packet_t *)0 : header;
+    packet->data = header->data;
+    packet->size = size;
+    packet->chain = rest;
+    return XNET_ERR_OK;
+}
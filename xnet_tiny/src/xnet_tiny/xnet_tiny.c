@@ -1,24 +1,50 @@
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE                 // sched_setaffinity
+#endif
 #include <string.h>
 #include <stdio.h> 
+#if defined(_WIN32)
 #include <windows.h>    
+#else
+#include <time.h>
+#include <sched.h>
+#endif
 #include "xnet_tiny.h"
+#include "xnet_capture.h"
 
 #undef min
 #define min(a, b)               ((a) > (b) ? (b) : (a))
 #define swap_order16(v)         ((((v) & 0xFF) << 8) | (((v) >> 8) & 0xFF))
+
+// 诊断信息，XNET_CFG_DEBUG 为 0 时不编译
+#if XNET_CFG_DEBUG
+#define xnet_dbg(...)           printf(__VA_ARGS__)
+#else
+#define xnet_dbg(...)           ((void)0)
+#endif
 static void arp_send_request(const uint8_t ip[4]);
 
-static void xicmp_in(const uint8_t src_ip[4], xnet_packet_t *packet);
+static void xicmp_in(xnet_packet_t *packet);
 static uint8_t netif_mac[XNET_MAC_ADDR_SIZE];               // 本机 MAC 地址
 static uint8_t netif_ip[4];                                 // 本机 IP 地址（网络字节序）
-static xnet_packet_t tx_packet, rx_packet;                  // 收发缓冲区
 static const uint8_t broadcast_mac[XNET_MAC_ADDR_SIZE] = {  // 以太网广播 MAC
         0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
 };
 
 static xarp_entry_t arp_table[XARP_TABLE_SIZE];
 static uint32_t arp_timer_ticks = 0;
-
+static xnet_stats_t xnet_stats;                             // 收发统计
+static xnet_packet_t rx_batch[XNET_CFG_RX_BATCH];           // 批量接收缓冲区
+static uint16_t poll_budget = XNET_CFG_POLL_BUDGET;         // 每次 poll 最多处理的帧数
+static uint16_t netif_mtu = XNET_CFG_MTU;                   // 发出的 IP 包的最大长度
+static uint32_t last_tick_ms;                               // 上一个 tick 的时间
+static uint16_t stats_ticks;                                // 距上次读取驱动统计的 tick 数
+static xnet_wait_mode_t wait_mode = XNET_WAIT_NONE;         // 空闲时的等待方式
+static uint32_t wait_max_ms = XNET_TICK_MS;                 // 阻塞等待的最长时间
+static uint32_t busy_backoff;                               // 忙轮询当前的退避次数
+static const uint8_t ip_protocols[] = {XIP_PROTOCOL_ICMP};  // 启用的 IP 上层协议，接收过滤器只放行这些
+
+#if XNET_CFG_ARP_TABLE_PRINT
 // Print current ARP table for debugging
 static void print_arp_table(void) {
     printf("--- ARP Table ---\n");
@@ -46,76 +72,205 @@ static void print_arp_table(void) {
     }
     printf("-----------------\n");
 }
+#else
+#define print_arp_table()       ((void)0)
+#endif
 
+#if XNET_CFG_TRACEROUTE
 // Traceroute state
 static uint8_t traceroute_reached_dest = 0;   // 是否已经到达目的主机
 static uint8_t traceroute_active      = 0;   // 当前是否在 traceroute 模式
 static uint8_t traceroute_hop_replied = 0;   // 当前这一跳是否收到 Time Exceeded
-static int last_icmp_rtt              = -1;  // 最近一次 ICMP Echo Reply 的 RTT（ms）
+#endif
+
+#if XNET_CFG_PING
+static int64_t last_icmp_rtt_ns      = -1;  // 最近一次 ICMP Echo Reply 的 RTT（ns）
+static int64_t last_icmp_stack_ns    = -1;  // 最近一次回复对应请求的协议栈发送开销（ns）
 
-static uint32_t xnet_now_ms(void) {
+/**
+ * 已发出的探测包：回复到来时按 id/seq 找回发送时间
+ */
+typedef struct _xicmp_probe_t {
+    uint16_t id;
+    uint16_t seq;
+    uint64_t tx_ns;                          // 开始构造请求的时间，0 表示空闲
+    uint64_t sent_ns;                        // 离开驱动的时间：驱动回报的时间戳，或交给驱动后读取的时钟
+} xicmp_probe_t;
+static xicmp_probe_t probe_table[XNET_CFG_PROBE_SLOTS];
+static uint16_t probe_next;
+static uint16_t tx_stamps_expected;          // 已请求、尚未取回的发送时间戳数
+#endif
+static uint32_t driver_caps;                 // 当前驱动的能力
+
+uint32_t xnet_now_ms(void) {
+#if defined(_WIN32)
     // GetTickCount64 返回毫秒级时间戳
     return (uint32_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+#endif
 }
 
+/**
+ * 与驱动接收时间戳同一时基的时间（ns）：pcap、AF_PACKET 的时间戳都是墙上时间
+ */
+uint64_t xnet_time_ns(void) {
+#if defined(_WIN32)
+    FILETIME ft;
+    uint64_t t;
+
+    // FILETIME 为自 1601 年起的 100ns 数
+    GetSystemTimePreciseAsFileTime(&ft);
+    t = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return (t - 116444736000000000ULL) * 100;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#if XNET_CFG_PING
 int xicmp_get_last_rtt(void) {
-    int rtt = last_icmp_rtt;
-    last_icmp_rtt = -1;
-    return rtt;
+    int64_t rtt = xicmp_get_last_rtt_ns();
+    return rtt < 0 ? -1 : (int)(rtt / 1000000);
 }
-// Virtual traceroute hops to simulate intermediate routers when running on a flat network.
-#define XNET_VROUTER_ENABLE 1
-#define XNET_VROUTER_HOP_COUNT 2
-static const uint8_t virtual_hops[XNET_VROUTER_HOP_COUNT][XNET_IP_ADDR_SIZE] = {
-    {192, 168, 232, 254},
-    {10, 0, 0, 1},
-};
 
-// Ping id/seq generator could be kept externally; provide helper function below
+int64_t xicmp_get_last_rtt_ns(void) {
+    int64_t rtt = last_icmp_rtt_ns;
+    last_icmp_rtt_ns = -1;
+    return rtt;
+}
 
-static uint16_t ip_checksum16(const void *buf, uint16_t len);
-static uint16_t icmp_checksum16(const void *buf, uint16_t len);
+int64_t xicmp_get_last_stack_ns(void) {
+    return last_icmp_stack_ns;
+}
 
 /**
- * 分配一个发送用的数据包
+ * 记录开始构造探测包的时间，最旧的记录被覆盖
  */
-xnet_packet_t * xnet_alloc_for_send(uint16_t data_size) {
-    tx_packet.data = tx_packet.payload + XNET_CFG_PACKET_MAX_SIZE - data_size;
-    tx_packet.size = data_size;
-    return &tx_packet;
+static void xicmp_probe_record(uint16_t id, uint16_t seq) {
+    xicmp_probe_t * probe = &probe_table[probe_next];
+
+    probe->id = id;
+    probe->seq = seq;
+    probe->tx_ns = xnet_time_ns();
+    probe->sent_ns = 0;
+    probe_next = (uint16_t)((probe_next + 1) % XNET_CFG_PROBE_SLOTS);
+}
+
+static xicmp_probe_t * xicmp_probe_find(uint16_t id, uint16_t seq) {
+    for (int i = 0; i < XNET_CFG_PROBE_SLOTS; i++) {
+        xicmp_probe_t * probe = &probe_table[i];
+
+        if (probe->tx_ns && (probe->id == id) && (probe->seq == seq)) {
+            return probe;
+        }
+    }
+    return (xicmp_probe_t *)0;
 }
 
 /**
- * 分配一个接收用的数据包
+ * 按发出的以太网帧中 ICMP 请求的 id/seq 找回探测包
+ * @return 探测包，帧不是 Echo Request 或没有记录时返回 0
  */
-xnet_packet_t * xnet_alloc_for_read(uint16_t data_size) {
-    rx_packet.data = rx_packet.payload;
-    rx_packet.size = data_size;
-    return &rx_packet;
+static xicmp_probe_t * xicmp_probe_from_frame(const uint8_t * frame, uint16_t size) {
+    const xether_hdr_t * ether = (const xether_hdr_t *)frame;
+    const xip_hdr_t * ip = (const xip_hdr_t *)(frame + sizeof(xether_hdr_t));
+    const xicmp_hdr_t * icmp;
+    uint16_t ip_hdr_len;
+
+    if ((size < sizeof(xether_hdr_t) + sizeof(xip_hdr_t) + sizeof(xicmp_hdr_t))
+        || (swap_order16(ether->protocol) != XNET_PROTOCOL_IP) || (ip->protocol != XIP_PROTOCOL_ICMP)) {
+        return (xicmp_probe_t *)0;
+    }
+    ip_hdr_len = (uint16_t)((ip->ver_hdrlen & 0x0F) * 4);
+    if (size < sizeof(xether_hdr_t) + ip_hdr_len + sizeof(xicmp_hdr_t)) {
+        return (xicmp_probe_t *)0;
+    }
+
+    icmp = (const xicmp_hdr_t *)((const uint8_t *)ip + ip_hdr_len);
+    if (icmp->type != XICMP_TYPE_ECHO_REQUEST) {
+        return (xicmp_probe_t *)0;
+    }
+    return xicmp_probe_find(icmp->id, icmp->seq);
 }
 
 /**
- * 为数据包增加一个头部
+ * 探测包已交给驱动：先记下此刻的时钟，驱动稍后回报的发送时间戳会覆盖它。
+ * 在帧交给驱动时调用，暂存在 ARP 表项中的探测包等到真正发出时才记录
  */
-static void add_header(xnet_packet_t *packet, uint16_t header_size) {
-    packet->data -= header_size;
-    packet->size += header_size;
+static void xicmp_probe_sent(const uint8_t * frame, uint16_t size) {
+    xicmp_probe_t * probe = xicmp_probe_from_frame(frame, size);
+
+    if (probe && (probe->sent_ns == 0)) {
+        probe->sent_ns = xnet_time_ns();
+    }
 }
 
 /**
- * 去掉数据包前面的一个头部
+ * 取回驱动回报的发送时间戳，按帧中 ICMP 请求的 id/seq 填回探测包
  */
-static void remove_header(xnet_packet_t *packet, uint16_t header_size) {
-    packet->data += header_size;
-    packet->size -= header_size;
+static void xicmp_probe_tx_stamps(void) {
+    const uint8_t * frame;
+    uint16_t size;
+    uint64_t timestamp;
+
+    while (xnet_driver_tx_timestamp(&frame, &size, &timestamp) == XNET_ERR_OK) {
+        xicmp_probe_t * probe = xicmp_probe_from_frame(frame, size);
+
+        xnet_stats.tx_timestamps++;
+        if (tx_stamps_expected) {
+            tx_stamps_expected--;
+        }
+
+        if (probe && (timestamp >= probe->tx_ns)) {
+            probe->sent_ns = timestamp;
+        }
+    }
 }
 
 /**
- * 将数据包长度裁剪为不超过 size
+ * 由回复的接收时间戳计算 RTT，找到的记录随即释放
+ * RTT 从请求离开驱动时算起，此前在协议栈中花费的时间单独记为发送开销
+ * @param stack_ns 协议栈发送开销，没有交给驱动的探测包（如虚拟路由器应答）为 -1
+ * @return RTT（ns），没有对应的探测包时返回 -1
  */
-static void truncate_packet(xnet_packet_t *packet, uint16_t size) {
-    packet->size = min(packet->size, size);
+static int64_t xicmp_probe_rtt(uint16_t id, uint16_t seq, uint64_t rx_ns, int64_t * stack_ns) {
+    xicmp_probe_t * probe = xicmp_probe_find(id, seq);
+    uint64_t sent_ns;
+
+    *stack_ns = -1;
+    if (probe == (xicmp_probe_t *)0) {
+        return -1;
+    }
+
+    sent_ns = probe->tx_ns;
+    if (probe->sent_ns) {
+        sent_ns = probe->sent_ns;
+        *stack_ns = (int64_t)(probe->sent_ns - probe->tx_ns);
+    }
+    probe->tx_ns = 0;
+    return (rx_ns > sent_ns) ? (int64_t)(rx_ns - sent_ns) : 0;
 }
+#endif
+
+#if XNET_CFG_VROUTER
+// Virtual traceroute hops to simulate intermediate routers when running on a flat network.
+#define XNET_VROUTER_HOP_COUNT 2
+static const uint8_t virtual_hops[XNET_VROUTER_HOP_COUNT][XNET_IP_ADDR_SIZE] = {
+    {192, 168, 232, 254},
+    {10, 0, 0, 1},
+};
+#endif
+
+// Ping id/seq generator could be kept externally; provide helper function below
+
+static uint16_t ip_checksum16(const void *buf, uint16_t len);
+static uint16_t icmp_checksum16(const void *buf, uint16_t len);
+static xnet_err_t ethernet_out_to(xnet_protocol_t protocol, const uint8_t *mac_addr, xnet_packet_t * packet);
 
 /**
  * 以太网层初始化
@@ -124,6 +279,8 @@ static xnet_err_t ethernet_init (void) {
     xnet_err_t err = xnet_driver_open(netif_mac);
     if (err < 0) return err;
 
+    driver_caps = xnet_driver_caps();
+
     return XNET_ERR_OK;
 }
 
@@ -160,37 +317,140 @@ static xarp_entry_t * arp_table_alloc(const uint8_t ip[4]) {
     return 0;
 }
 
+/**
+ * 把一个待发的 IP 包放入 ARP 表项的暂存队列末尾，队列已满时丢弃最早的一个。
+ * 队列中放的是克隆，与调用者共用缓冲区，不复制数据
+ * @return 0 - 成功，其它 - 池已用完
+ */
+static xnet_err_t arp_hold_packet(xarp_entry_t *e, xnet_packet_t *packet) {
+    xnet_packet_t *copy = xnet_clone(packet);
+    xnet_packet_t **tail;
+
+    if (!copy) {
+        xnet_stats.arp_queue_dropped++;
+        return XNET_ERR_IO;
+    }
+
+    if (e->hold_count >= XNET_CFG_ARP_QUEUE_DEPTH) {
+        xnet_packet_t *oldest = e->hold;
+
+        e->hold = oldest->next;
+        e->hold_count--;
+        xnet_free(oldest);
+        xnet_stats.arp_queue_dropped++;
+    }
+
+    for (tail = &e->hold; *tail; tail = &(*tail)->next) {
+    }
+    *tail = copy;
+    e->hold_count++;
+    xnet_stats.arp_queued++;
+    return XNET_ERR_OK;
+}
+
+/**
+ * 解析完成后按顺序发出暂存的 IP 包
+ */
+static void arp_hold_flush(xarp_entry_t *e) {
+    while (e->hold) {
+        xnet_packet_t *packet = e->hold;
+
+        e->hold = packet->next;
+        packet->next = (xnet_packet_t *)0;
+        if (ethernet_out_to(XNET_PROTOCOL_IP, e->mac, packet) == XNET_ERR_OK) {
+            xnet_stats.arp_queue_sent++;
+        }
+        xnet_free(packet);
+    }
+    e->hold_count = 0;
+}
 
 /**
- * 发送一个以太网帧
+ * 丢弃暂存的 IP 包，表项超时释放前调用
  */
-static xnet_err_t ethernet_out_to(xnet_protocol_t protocol,
-                                  const uint8_t *mac_addr,
-                                  xnet_packet_t * packet) {
+static void arp_hold_drop(xarp_entry_t *e) {
+    while (e->hold) {
+        xnet_packet_t *packet = e->hold;
+
+        e->hold = packet->next;
+        xnet_free(packet);
+        xnet_stats.arp_queue_dropped++;
+    }
+    e->hold_count = 0;
+}
+
+
+/**
+ * 为一段连续的数据加上以太网头并交给驱动
+ */
+static xnet_err_t ethernet_send_frame(xnet_protocol_t protocol,
+                                      const uint8_t *mac_addr,
+                                      xnet_packet_t * packet) {
     xether_hdr_t* ether_hdr;
 
-    add_header(packet, sizeof(xether_hdr_t));
-    ether_hdr = (xether_hdr_t*)packet->data;
+    ether_hdr = (xether_hdr_t*)xnet_push(packet, sizeof(xether_hdr_t));
+    if (ether_hdr == (xether_hdr_t *)0) {
+        xnet_stats.tx_dropped++;
+        return XNET_ERR_IO;
+    }
     memcpy(ether_hdr->dest, mac_addr, XNET_MAC_ADDR_SIZE);
     memcpy(ether_hdr->src, netif_mac, XNET_MAC_ADDR_SIZE);
     ether_hdr->protocol = swap_order16(protocol);
 
-    // 【新增修复】处理以太网最小帧长限制 (60 bytes)
+    // 不足以太网最小帧长 (60 bytes) 时在尾部空间中补 0
     if (packet->size < 60) {
-        // 计算需要填充的字节数
         uint16_t padding_size = 60 - packet->size;
-        // 确保不超过最大缓冲区
-        if (packet->size + padding_size <= XNET_CFG_PACKET_MAX_SIZE) {
-            // 将 packet->data 及其后面的 padding 区域清零（通常 ARP 后面填 0 即可）
-            memset(packet->data + packet->size, 0, padding_size);
-            // 更新包的大小
-            packet->size += padding_size;
+        uint8_t * padding = xnet_put(packet, padding_size);
+
+        if (padding) {
+            memset(padding, 0, padding_size);
         }
     }
 
-    return xnet_driver_send(packet);
+    xnet_stats.tx_packets++;
+    xnet_stats.tx_bytes += packet->size;
+    xnet_capture_frame(XNET_CAPTURE_TX, packet->data, packet->size, xnet_time_ns());
+    if (!(packet->flags & XNET_PACKET_TX_TIMESTAMP)) {
+        return xnet_driver_send(packet);
+    }
+
+    // 需要发送时间戳的帧不在发送队列中等待，立即交给网卡
+    if (xnet_driver_send(packet) != XNET_ERR_OK) {
+        return XNET_ERR_IO;
+    }
+#if XNET_CFG_PING
+    xicmp_probe_sent(packet->data, packet->size);
+    if (driver_caps & XNET_DRIVER_CAP_TX_TIMESTAMP) {
+        tx_stamps_expected++;
+    }
+#endif
+    xnet_flush();
+    return XNET_ERR_OK;
 }
 
+/**
+ * 发送一个以太网帧；分段或与别人共用缓冲区的数据包先复制成可写的一段，驱动只处理连续的帧
+ * 发送后 packet 仍归调用者所有；没有复制时 data 指向以太网头
+ */
+static xnet_err_t ethernet_out_to(xnet_protocol_t protocol,
+                                  const uint8_t *mac_addr,
+                                  xnet_packet_t * packet) {
+    xnet_packet_t * frame = xnet_linearize(packet);
+    xnet_err_t err;
+
+    if (frame == (xnet_packet_t *)0) {
+        xnet_stats.tx_dropped++;
+        return XNET_ERR_IO;
+    }
+
+    err = ethernet_send_frame(protocol, mac_addr, frame);
+    if (frame != packet) {
+        xnet_free(frame);
+    }
+    return err;
+}
+
+#if XNET_CFG_PING
 // Generate and send ICMP Destination Unreachable (Host Unreachable)
 // to self, simulating a router response when ARP fails.
 static void send_host_unreachable(const uint8_t *target_ip) {
@@ -204,6 +464,7 @@ static void send_host_unreachable(const uint8_t *target_ip) {
     uint16_t total_len = (uint16_t)(sizeof(xicmp_hdr_t) + icmp_payload_len);
     
     xnet_packet_t *packet = xnet_alloc_for_send(total_len);
+    if (!packet) return;
     
     // 3. Fill ICMP Error Header
     xicmp_hdr_t *icmp = (xicmp_hdr_t *)packet->data;
@@ -239,8 +500,11 @@ static void send_host_unreachable(const uint8_t *target_ip) {
     icmp->checksum = icmp_checksum16(icmp, total_len);
     
     // 6. Wrap in IP Header (From Me To Me)
-    add_header(packet, sizeof(xip_hdr_t));
-    xip_hdr_t *ip = (xip_hdr_t *)packet->data;
+    xip_hdr_t *ip = (xip_hdr_t *)xnet_push(packet, sizeof(xip_hdr_t));
+    if (!ip) {
+        xnet_free(packet);
+        return;
+    }
     ip->ver_hdrlen = 0x45;
     ip->tos = 0;
     ip->total_len = swap_order16(packet->size);
@@ -255,10 +519,12 @@ static void send_host_unreachable(const uint8_t *target_ip) {
     
     // 7. Send to Ethernet (Loopback to self)
     ethernet_out_to(XNET_PROTOCOL_IP, netif_mac, packet);
+    xnet_free(packet);
     
-    printf("Generated ICMP Host Unreachable for %d.%d.%d.%d\n",
+    xnet_dbg("Generated ICMP Host Unreachable for %d.%d.%d.%d\n",
         target_ip[0], target_ip[1], target_ip[2], target_ip[3]);
 }
+#endif
 
 /**
  * 发送一次“无回报 ARP”（gratuitous ARP）
@@ -266,6 +532,7 @@ static void send_host_unreachable(const uint8_t *target_ip) {
  */
 static void arp_send_gratuitous(void) {
     xnet_packet_t *packet = xnet_alloc_for_send((uint16_t)sizeof(xarp_packet_t));
+    if (!packet) return;
     xarp_packet_t *arp = (xarp_packet_t *)packet->data;
 
     arp->hw_type    = swap_order16(1);                 // 以太网
@@ -280,18 +547,18 @@ static void arp_send_gratuitous(void) {
     memcpy(arp->target_ip,  netif_ip,  4);
 
     ethernet_out_to(XNET_PROTOCOL_ARP, broadcast_mac, packet);
+    xnet_free(packet);
 }
 
 /**
- * ARP 报文输入处理
+ * ARP 报文输入处理，收到的报文只读，应答在发送缓冲区中构造
  */
 static void arp_in(xnet_packet_t *packet) {
-    if (packet->size < sizeof(xarp_packet_t)) {
+    if ((uint32_t)(packet->size - packet->meta.l3_offset) < sizeof(xarp_packet_t)) {
         return;
     }
 
-    truncate_packet(packet, sizeof(xarp_packet_t));
-    xarp_packet_t *arp = (xarp_packet_t*)packet->data;
+    xarp_packet_t *arp = (xarp_packet_t*)(packet->data + packet->meta.l3_offset);
 
     uint16_t hw_type    = swap_order16(arp->hw_type);
     uint16_t proto_type = swap_order16(arp->proto_type);
@@ -305,43 +572,42 @@ static void arp_in(xnet_packet_t *packet) {
     }
 
     if (memcmp(arp->target_ip, netif_ip, 4) != 0) {
+        xnet_stats.rx_filtered++;
         return;
     }
 
     if (opcode == XARP_OPCODE_REQUEST) {
-        uint8_t reply_target_mac[XNET_MAC_ADDR_SIZE];
-        uint8_t reply_target_ip[4];
-
-        memcpy(reply_target_mac, arp->sender_mac, XNET_MAC_ADDR_SIZE);
-        memcpy(reply_target_ip,  arp->sender_ip,  4);
-
-        arp->hw_type    = swap_order16(1);
-        arp->proto_type = swap_order16(XNET_PROTOCOL_IP);
-        arp->hw_len     = XNET_MAC_ADDR_SIZE;
-        arp->proto_len  = 4;
-        arp->opcode     = swap_order16(XARP_OPCODE_REPLY);
-
-        memcpy(arp->sender_mac, netif_mac,        XNET_MAC_ADDR_SIZE);
-        memcpy(arp->sender_ip,  netif_ip,         4);
-        memcpy(arp->target_mac, reply_target_mac, XNET_MAC_ADDR_SIZE);
-        memcpy(arp->target_ip,  reply_target_ip,  4);
-
-        ethernet_out_to(XNET_PROTOCOL_ARP, reply_target_mac, packet);
+        xnet_packet_t *reply = xnet_alloc_for_send((uint16_t)sizeof(xarp_packet_t));
+        if (!reply) return;
+        xarp_packet_t *reply_arp = (xarp_packet_t *)reply->data;
+
+        reply_arp->hw_type    = swap_order16(1);
+        reply_arp->proto_type = swap_order16(XNET_PROTOCOL_IP);
+        reply_arp->hw_len     = XNET_MAC_ADDR_SIZE;
+        reply_arp->proto_len  = 4;
+        reply_arp->opcode     = swap_order16(XARP_OPCODE_REPLY);
+
+        memcpy(reply_arp->sender_mac, netif_mac,       XNET_MAC_ADDR_SIZE);
+        memcpy(reply_arp->sender_ip,  netif_ip,        4);
+        memcpy(reply_arp->target_mac, arp->sender_mac, XNET_MAC_ADDR_SIZE);
+        memcpy(reply_arp->target_ip,  arp->sender_ip,  4);
+
+        ethernet_out_to(XNET_PROTOCOL_ARP, reply_arp->target_mac, reply);
+        xnet_free(reply);
     } else if (opcode == XARP_OPCODE_REPLY) {
         xarp_entry_t *e = arp_table_find(arp->sender_ip);
         if (e == 0) {
             e = arp_table_alloc(arp->sender_ip);
         }
         if (e) {
-            int index = (int)(e - arp_table);  // 新建 index 变量
-
             memcpy(e->mac, arp->sender_mac, XNET_MAC_ADDR_SIZE);
             e->state = XARP_ENTRY_OK;
             e->ttl = 100;        // 100 个“tick”后过期
             e->retry = 0;
+            arp_hold_flush(e);
 
-            printf("ARP update[%d]: %d.%d.%d.%d -> %02X:%02X:%02X:%02X:%02X:%02X\n",
-               index,
+            xnet_dbg("ARP update[%d]: %d.%d.%d.%d -> %02X:%02X:%02X:%02X:%02X:%02X\n",
+               (int)(e - arp_table),
                arp->sender_ip[0], arp->sender_ip[1], arp->sender_ip[2], arp->sender_ip[3],
                arp->sender_mac[0], arp->sender_mac[1], arp->sender_mac[2],
                arp->sender_mac[3], arp->sender_mac[4], arp->sender_mac[5]);
@@ -354,7 +620,7 @@ static void arp_in(xnet_packet_t *packet) {
 const uint8_t * arp_resolve(const uint8_t ip[4]) {
     xarp_entry_t *e = arp_table_find(ip);
     if (e && e->state == XARP_ENTRY_OK) {
-        printf("ARP hit: %d.%d.%d.%d -> %02X:%02X:%02X:%02X:%02X:%02X\n",
+        xnet_dbg("ARP hit: %d.%d.%d.%d -> %02X:%02X:%02X:%02X:%02X:%02X\n",
         ip[0], ip[1], ip[2], ip[3],
         e->mac[0], e->mac[1], e->mac[2], e->mac[3], e->mac[4], e->mac[5]);
         return e->mac;
@@ -394,24 +660,27 @@ void arp_table_timer(void) {
             if (e->retry > 0) {
                 e->retry--;
                 e->ttl = 5;   // retry sooner to avoid long ARP stalls
-                printf("ARP retry[%d]: %d.%d.%d.%d, left=%d\n",
+                xnet_dbg("ARP retry[%d]: %d.%d.%d.%d, left=%d\n",
                        i, e->ip[0], e->ip[1], e->ip[2], e->ip[3], e->retry);
                 arp_send_request(e->ip);
                 // Print ARP table after retry count changed
                 print_arp_table();
             } else {
-                printf("ARP timeout free[%d]: %d.%d.%d.%d\n",
+                xnet_dbg("ARP timeout free[%d]: %d.%d.%d.%d\n",
                        i, e->ip[0], e->ip[1], e->ip[2], e->ip[3]);
                 
                 // Send ICMP Host Unreachable before freeing
+                arp_hold_drop(e);
+#if XNET_CFG_PING
                 send_host_unreachable(e->ip);
+#endif
 
                 e->state = XARP_ENTRY_FREE;
                 // Print ARP table after freeing entry
                 print_arp_table();
             }
         } else if (e->state == XARP_ENTRY_OK && e->ttl == 0) {
-            printf("ARP entry expired[%d]: %d.%d.%d.%d\n",
+            xnet_dbg("ARP entry expired[%d]: %d.%d.%d.%d\n",
                    i, e->ip[0], e->ip[1], e->ip[2], e->ip[3]);
             e->state = XARP_ENTRY_FREE;
             // Print ARP table after expiration
@@ -423,6 +692,7 @@ void arp_table_timer(void) {
 
 static void arp_send_request(const uint8_t ip[4]) {
     xnet_packet_t *packet = xnet_alloc_for_send((uint16_t)sizeof(xarp_packet_t));
+    if (!packet) return;
     xarp_packet_t *arp = (xarp_packet_t *)packet->data;
 
     arp->hw_type    = swap_order16(1);                 // 以太网
@@ -437,158 +707,447 @@ static void arp_send_request(const uint8_t ip[4]) {
     memcpy(arp->target_ip,  ip,        4);             // 要查询的 IP
 
     ethernet_out_to(XNET_PROTOCOL_ARP, broadcast_mac, packet);
+    xnet_free(packet);
 }
 
 
+/**
+ * 帧进入协议栈时解析一次以太网头与 IPv4 头，结果填入 packet->meta
+ * 只检查结构是否完整，校验和与目的地址的处理留给各层
+ * @return 0 - 成功，其它 - 帧不完整或 IP 头格式错误
+ */
+static xnet_err_t packet_parse(xnet_packet_t *packet) {
+    xnet_meta_t *meta = &packet->meta;
+
+    if (packet->size <= sizeof(xether_hdr_t)) {
+        return XNET_ERR_IO;
+    }
+
+    const xether_hdr_t *eth = (const xether_hdr_t *)packet->data;
+    meta->l2_protocol = swap_order16(eth->protocol);
+    meta->l3_offset = sizeof(xether_hdr_t);
+    meta->l4_offset = 0;
+    meta->l4_size = 0;
+    meta->l4_protocol = 0;
+    meta->flags = (memcmp(eth->dest, broadcast_mac, XNET_MAC_ADDR_SIZE) == 0) ? XNET_META_BROADCAST : 0;
+    if (meta->l2_protocol != XNET_PROTOCOL_IP) {
+        return XNET_ERR_OK;
+    }
+
+    const xip_hdr_t *ip = (const xip_hdr_t *)(packet->data + meta->l3_offset);
+    uint16_t l3_size = packet->size - meta->l3_offset;
+    if (l3_size < sizeof(xip_hdr_t)) {
+        return XNET_ERR_IO;
+    }
+
+    uint16_t hdr_len = (ip->ver_hdrlen & 0x0F) * 4;
+    uint16_t total_len = swap_order16(ip->total_len);
+    if (((ip->ver_hdrlen >> 4) != 4) || (hdr_len < sizeof(xip_hdr_t))
+        || (total_len < hdr_len) || (total_len > l3_size)) {
+        return XNET_ERR_IO;
+    }
+
+    meta->l4_offset = meta->l3_offset + hdr_len;
+    meta->l4_size = total_len - hdr_len;
+    meta->l4_protocol = ip->protocol;
+    memcpy(meta->src_ip, ip->src_ip, XNET_IP_ADDR_SIZE);
+    memcpy(meta->dest_ip, ip->dest_ip, XNET_IP_ADDR_SIZE);
+    meta->flags |= XNET_META_IPV4;
+    if (memcmp(ip->dest_ip, netif_ip, XNET_IP_ADDR_SIZE) == 0) {
+        meta->flags |= XNET_META_TO_US;
+    }
+    return XNET_ERR_OK;
+}
+
 /**
  * 以太网帧输入处理
  */
 static void ethernet_in (xnet_packet_t * packet) {
-    if (packet->size <= sizeof(xether_hdr_t)) {
+    if (packet_parse(packet) != XNET_ERR_OK) {
         return;
     }
 
-    xether_hdr_t* hdr = (xether_hdr_t*)packet->data;
-    switch (swap_order16(hdr->protocol)) {
+    switch (packet->meta.l2_protocol) {
         case XNET_PROTOCOL_ARP:
-            remove_header(packet, sizeof(xether_hdr_t));
             arp_in(packet);
             break;
         case XNET_PROTOCOL_IP:
-            remove_header(packet, sizeof(xether_hdr_t));
             xip_in(packet);        // 把 IP 数据包交给 IP 层
             break;
         default:
+            xnet_stats.rx_filtered++;
             break;
     }
 }
 
 /**
- * 轮询底层网卡
+ * 轮询底层网卡：一次取出一批帧，直到驱动中没有数据或用完本次 poll 的预算
  */
 static void ethernet_poll (void) {
-    xnet_packet_t * packet;
+    uint16_t left = poll_budget;
+    uint16_t total = 0;
+
+    while (left > 0) {
+        uint16_t count = xnet_driver_read_batch(rx_batch, min(left, XNET_CFG_RX_BATCH));
+
+#if XNET_CFG_PING
+        // 回复可能就在这一批中，先取回请求的发送时间戳
+        if (tx_stamps_expected) {
+            xicmp_probe_tx_stamps();
+        }
+#endif
+        if (count == 0) {
+            break;
+        }
 
-    if (xnet_driver_read(&packet) == XNET_ERR_OK) {
-        ethernet_in(packet);
+        // 驱动不提供时间戳时，用取出这一批的时间代替
+        if (!(driver_caps & XNET_DRIVER_CAP_RX_TIMESTAMP)) {
+            uint64_t now = xnet_time_ns();
+            for (uint16_t i = 0; i < count; i++) {
+                rx_batch[i].rx_ts_ns = now;
+            }
+        }
+
+        for (uint16_t i = 0; i < count; i++) {
+            // 驱动不给出校验和状态时，清掉数组中上一次留下的标志
+            if (!(driver_caps & XNET_DRIVER_CAP_RX_CSUM)) {
+                rx_batch[i].flags = 0;
+            }
+            xnet_stats.rx_packets++;
+            xnet_stats.rx_bytes += rx_batch[i].size;
+            xnet_capture_frame(XNET_CAPTURE_RX, rx_batch[i].data, rx_batch[i].size, rx_batch[i].rx_ts_ns);
+            ethernet_in(&rx_batch[i]);
+        }
+        xnet_driver_release(rx_batch, count);   // 借出的缓冲区处理完毕，还给驱动
+
+        xnet_stats.rx_batches++;
+        left -= count;
+        total += count;
+    }
+
+    xnet_stats.polls++;
+    xnet_stats.last_poll_packets = total;
+    if (total == 0) {
+        xnet_stats.empty_polls++;
+    } else if (left == 0) {
+        xnet_stats.budget_exhausted++;   // 驱动中可能还有帧，留到下一次 poll
+    }
+    if (total > xnet_stats.max_poll_packets) {
+        xnet_stats.max_poll_packets = total;
+    }
+}
+
+/**
+ * 读取驱动的接收统计，内核或网卡丢帧时给出提示：说明 poll 不够及时或内核缓冲区太小
+ */
+static void ethernet_update_driver_stats (void) {
+    xnet_driver_stats_t stats;
+
+    if (xnet_driver_stats(&stats) != XNET_ERR_OK) {
+        return;
+    }
+
+    if ((stats.drop != xnet_stats.driver.drop) || (stats.ifdrop != xnet_stats.driver.ifdrop)) {
+        xnet_dbg("driver: dropped %u frames in kernel, %u by interface (recv %u)\n",
+               stats.drop - xnet_stats.driver.drop, stats.ifdrop - xnet_stats.driver.ifdrop, stats.recv);
+    }
+    if (stats.irq_drop != xnet_stats.driver.irq_drop) {
+        xnet_dbg("driver: dropped %u frames in rx queue\n", stats.irq_drop - xnet_stats.driver.irq_drop);
     }
+    xnet_stats.driver = stats;
+}
+
+/**
+ * 设置每次 poll 最多处理的帧数
+ */
+void xnet_set_poll_budget(uint16_t budget) {
+    poll_budget = budget ? budget : 1;
+}
+
+/**
+ * 获取协议栈收发统计
+ */
+const xnet_stats_t * xnet_get_stats(void) {
+    return &xnet_stats;
+}
+
+/**
+ * 设置 xnet_poll() 空闲时的等待方式
+ * @param mode 等待方式
+ * @param max_wait_ms 阻塞等待的最长时间，调用者自己的定时器更早到期时用它限制等待
+ */
+void xnet_set_wait_mode(xnet_wait_mode_t mode, uint32_t max_wait_ms) {
+    wait_mode = mode;
+    wait_max_ms = max_wait_ms;
+    busy_backoff = 0;
+}
+
+/**
+ * 把当前线程绑定到指定 CPU，忙轮询时避免被调度到其它核上
+ * @return 0 - 成功，其它失败
+ */
+xnet_err_t xnet_set_cpu(int cpu) {
+#if defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) ? XNET_ERR_OK : XNET_ERR_IO;
+#else
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0 ? XNET_ERR_OK : XNET_ERR_IO;
+#endif
+}
+
+static void xnet_cpu_relax(void) {
+#if defined(_MSC_VER)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void xnet_yield(void) {
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+/**
+ * 上一次 poll 没有收到帧时，按设定的方式等待下一帧
+ */
+static void xnet_wait(void) {
+    if (xnet_stats.last_poll_packets || (xnet_stats.polls == 0)) {
+        busy_backoff = 0;
+        return;
+    }
+
+    switch (wait_mode) {
+        case XNET_WAIT_BLOCK: {
+            // 最多等到下一个 tick，ARP 等定时器不会被推迟
+            uint32_t elapsed = xnet_now_ms() - last_tick_ms;
+            uint32_t timeout = (elapsed >= XNET_TICK_MS) ? 0 : (XNET_TICK_MS - elapsed);
+
+            timeout = min(timeout, wait_max_ms);
+            if (timeout > 0) {
+                xnet_flush();       // 阻塞前先把待发的帧交出去，否则对方的回复要等到超时后才会到来
+                xnet_driver_wait(timeout);
+                xnet_stats.waits++;
+            }
+            break;
+        }
+        case XNET_WAIT_BUSY:
+            // 指数退避：空轮询越多，两次读取之间 pause 越久，退避到上限后让出 CPU
+            for (uint32_t i = 0; i < busy_backoff; i++) {
+                xnet_cpu_relax();
+            }
+            if (busy_backoff < XNET_CFG_BUSY_BACKOFF_MAX) {
+                busy_backoff = busy_backoff ? (busy_backoff << 1) : 1;
+            } else {
+                xnet_yield();
+            }
+            break;
+        case XNET_WAIT_NONE:
+        default:
+            break;
+    }
+}
+
+/**
+ * 按本机地址与启用的协议生成接收过滤器交给驱动，不是发给本机的帧在内核中就被丢弃；
+ * 驱动不支持时由协议栈自己过滤
+ */
+static void ethernet_update_filter (void) {
+    net_filter_t filter;
+
+    memset(&filter, 0, sizeof(filter));
+    memcpy(filter.mac, netif_mac, XNET_MAC_ADDR_SIZE);
+    memcpy(filter.ip[0], netif_ip, 4);
+    filter.ip_count = 1;
+    memcpy(filter.protocol, ip_protocols, sizeof(ip_protocols));
+    filter.protocol_count = sizeof(ip_protocols);
+    xnet_driver_set_filter(&filter);
 }
 
 void xnet_init (void) {
     ethernet_init();
     arp_init();
+    ethernet_update_filter();
     arp_send_gratuitous();      // 启动时主动发送一次无回报 ARP
 }
 
+/**
+ * 更换本机 IP，在 xnet_init() 之后调用：重新生成接收过滤器，并发出无回报 ARP 通告新地址
+ */
+void xnet_set_ip(const uint8_t ip[4]) {
+    memcpy(netif_ip, ip, 4);
+    ethernet_update_filter();
+    arp_send_gratuitous();
+}
+
+/**
+ * 设置 MTU，不能超过编译时的上限 XNET_CFG_MTU；驱动按它设置抓取长度，
+ * 在 xnet_init() 之前调用才对驱动生效
+ * @return 0 - 成功，其它 - 超出范围，MTU 不变
+ */
+xnet_err_t xnet_set_mtu(uint16_t mtu) {
+    if ((mtu < 68) || (mtu > XNET_CFG_MTU)) {      // 68 为 IPv4 要求的最小 MTU
+        return XNET_ERR_IO;
+    }
+    netif_mtu = mtu;
+    return XNET_ERR_OK;
+}
+
+uint16_t xnet_get_mtu(void) {
+    return netif_mtu;
+}
+
+/**
+ * 把发送队列中的帧一次交给网卡
+ */
+void xnet_flush(void) {
+    xnet_stats.tx_flushes++;
+    xnet_driver_flush();
+}
+
 void xnet_poll(void) {
-    static uint32_t tick = 0;
+    uint32_t now;
+
+    xnet_wait();
     ethernet_poll();
 
-    if (++tick >= 10) {     // 每调用 10 次 poll 当作 1 个 tick
-        tick = 0;
+    now = xnet_now_ms();
+    // 每 100ms 当作 1 个 tick，与 poll 的调用频率无关，忙轮询时 ARP 表项也不会提前过期
+    if (now - last_tick_ms >= XNET_TICK_MS) {
+        last_tick_ms = now;
+#if XNET_CFG_PING
+        if (driver_caps & XNET_DRIVER_CAP_TX_TIMESTAMP) {
+            // 迟到或没有对应请求的时间戳也要取走，否则一直留在驱动中
+            xicmp_probe_tx_stamps();
+            tx_stamps_expected = 0;
+        }
+#endif
+        if (++stats_ticks >= XNET_CFG_DRIVER_STATS_TICKS) {
+            stats_ticks = 0;
+            ethernet_update_driver_stats();
+        }
         arp_table_timer();
         arp_timer_ticks++;   // increase global tick counter used for ping timestamps
     }
+
+    // 本次 poll 中产生的回复、ARP 请求等一次发出去
+    xnet_flush();
 }
 
 void xip_in(xnet_packet_t *packet) {
-    if (packet->size < sizeof(xip_hdr_t)) return;
-
-    xip_hdr_t *ip = (xip_hdr_t *)packet->data;
+    const xnet_meta_t *meta = &packet->meta;
+    if (!(meta->flags & XNET_META_IPV4)) return;
 
-    uint8_t ver  = ip->ver_hdrlen >> 4;
-    uint8_t ihl  = ip->ver_hdrlen & 0x0F;
-    uint16_t hdr_len = ihl * 4;
-    if (ver != 4 || hdr_len < sizeof(xip_hdr_t) || packet->size < hdr_len) return;
-
-    uint16_t chk = ip->hdr_checksum;
-    ip->hdr_checksum = 0;
-    if (ip_checksum16(ip, hdr_len) != chk) return;
-    ip->hdr_checksum = chk;
+    xip_hdr_t *ip = (xip_hdr_t *)(packet->data + meta->l3_offset);
+    uint16_t hdr_len = meta->l4_offset - meta->l3_offset;
 
-    if (memcmp(ip->dest_ip, netif_ip, 4) != 0) return;
-
-    // 先把对方 IP 拷出来，避免后面覆盖
-    uint8_t src_ip[4];
-    memcpy(src_ip, ip->src_ip, 4);
+    // 连同校验和字段一起计算，结果为 0 即正确，不需要改写只读的接收缓冲区；
+    // 网卡给出的 CSUM_VALID 只涵盖上层，线路上来的 IP 头照常验证，只有校验和尚未填好或帧未经过线路时跳过
+    if (packet->flags & (XNET_PACKET_CSUM_PARTIAL | XNET_PACKET_CSUM_LOCAL)) {
+        xnet_stats.ip_csum_skipped++;
+    } else if (ip_checksum16(ip, hdr_len) != 0) {
+        return;
+    }
 
-    remove_header(packet, hdr_len);
+    if (!(meta->flags & XNET_META_TO_US)) {
+        xnet_stats.rx_filtered++;
+        return;
+    }
 
-    if (ip->protocol == XIP_PROTOCOL_ICMP) {
-        xicmp_in(src_ip, packet);   // 传临时数组，而不是 ip->src_ip 指针
+    if (meta->l4_protocol == XIP_PROTOCOL_ICMP) {
+        xicmp_in(packet);
+    } else {
+        xnet_stats.rx_filtered++;
     }
 }
 
 
-static void xicmp_in(const uint8_t src_ip[4], xnet_packet_t *packet) {
-    if (packet->size < sizeof(xicmp_hdr_t)) return;
+static void xicmp_in(xnet_packet_t *packet) {
+    const uint8_t *src_ip = packet->meta.src_ip;
+    uint16_t size = packet->meta.l4_size;
+    if (size < sizeof(xicmp_hdr_t)) return;
 
-    xicmp_hdr_t *icmp = (xicmp_hdr_t *)packet->data;
+    xicmp_hdr_t *icmp = (xicmp_hdr_t *)(packet->data + packet->meta.l4_offset);
 
-    uint16_t recv_sum = icmp->checksum;
-    icmp->checksum = 0;
-    if (icmp_checksum16(icmp, packet->size) != recv_sum) return;
+    // 校验和要遍历整个负载，驱动已验证过、校验和尚未填好或帧未经过线路时跳过
+    if (packet->flags & (XNET_PACKET_CSUM_VALID | XNET_PACKET_CSUM_PARTIAL | XNET_PACKET_CSUM_LOCAL)) {
+        xnet_stats.icmp_csum_skipped++;
+    } else if (icmp_checksum16(icmp, size) != 0) {
+        return;
+    }
 
     if (icmp->type == 8 && icmp->code == 0) {  // Echo Request
-        // 直接在原报文上构造 Reply
-        icmp->type = 0;
-        icmp->checksum = 0;
-        icmp->checksum = icmp_checksum16(icmp, packet->size);
+        // 请求可能位于驱动借出的只读缓冲区，拷贝到发送缓冲区后再构造 Reply
+        xnet_packet_t *reply = xnet_alloc_for_send(size);
+        if (!reply) return;
+        xicmp_hdr_t *reply_icmp = (xicmp_hdr_t *)reply->data;
+
+        memcpy(reply->data, icmp, size);
+        reply_icmp->type = 0;
+        reply_icmp->checksum = 0;
+        reply_icmp->checksum = icmp_checksum16(reply_icmp, reply->size);
 
         // 通过 IP 层发回去：src_ip 是对方 IP
-        xip_out(XIP_PROTOCOL_ICMP, src_ip, packet);
+        xip_out(XIP_PROTOCOL_ICMP, src_ip, reply);
+        xnet_free(reply);
+#if XNET_CFG_PING
     } else if (icmp->type == 0 && icmp->code == 0) {
-        // Echo Reply: print information and RTT if timestamp present
+        // Echo Reply: RTT = 回复的接收时间戳 - 请求离开驱动的时间，不含 poll 的延迟与协议栈的发送开销
         uint16_t id = icmp->id;
         uint16_t seq = icmp->seq;
-        // payload may contain a 32-bit timestamp (arp_timer_ticks) placed by sender
-        uint32_t rtt_ticks = 0;
-        if (packet->size >= sizeof(xicmp_hdr_t) + 4) {
-            // timestamp stored in network byte order (we used host uint32 directly), read as little-endian
-            uint8_t *pdata = packet->data + sizeof(xicmp_hdr_t);
-            // reconstruct uint32 (host endian assumed little-endian on target)
-            rtt_ticks = (uint32_t)pdata[0] | ((uint32_t)pdata[1] << 8) | ((uint32_t)pdata[2] << 16) | ((uint32_t)pdata[3] << 24);
-            uint32_t now = xnet_now_ms();
-            uint32_t diff = (now >= rtt_ticks) ? (now - rtt_ticks) : 0;
-            last_icmp_rtt = (int)diff;
-            if (traceroute_active) {
-                printf("  Traceroute reached destination: %d.%d.%d.%d (rtt=%u ms)\n",
-                       src_ip[0], src_ip[1], src_ip[2], src_ip[3], diff);
-                traceroute_reached_dest = 1;
-                traceroute_active = 0;
+        int64_t stack_ns;
+        int64_t rtt = xicmp_probe_rtt(id, seq, packet->rx_ts_ns, &stack_ns);
+        if (rtt >= 0) {
+            last_icmp_rtt_ns = rtt;
+            last_icmp_stack_ns = stack_ns;
+        }
+#if XNET_CFG_TRACEROUTE
+        if (traceroute_active) {
+            if (rtt >= 0) {
+                printf("  Traceroute reached destination: %d.%d.%d.%d (rtt=%.3f ms)\n",
+                       src_ip[0], src_ip[1], src_ip[2], src_ip[3], rtt / 1e6);
             } else {
-                printf("PING reply: %d.%d.%d.%d id=%u seq=%u rtt=%u ms\n",
-                       src_ip[0], src_ip[1], src_ip[2], src_ip[3], id, seq, diff);
-            }
-        } else {
-            if (traceroute_active) {
                 printf("  Traceroute reached destination: %d.%d.%d.%d\n",
                        src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
-                traceroute_reached_dest = 1;
-                traceroute_active = 0;
-            } else {
-                printf("PING reply: %d.%d.%d.%d id=%u seq=%u\n",
-                       src_ip[0], src_ip[1], src_ip[2], src_ip[3], id, seq);
             }
+            traceroute_reached_dest = 1;
+            traceroute_active = 0;
+            return;
+        }
+#endif
+        if (rtt < 0) {
+            printf("PING reply: %d.%d.%d.%d id=%u seq=%u\n",
+                   src_ip[0], src_ip[1], src_ip[2], src_ip[3], id, seq);
+        } else if (stack_ns >= 0) {
+            printf("PING reply: %d.%d.%d.%d id=%u seq=%u wire rtt=%.3f ms stack=%.3f ms\n",
+                   src_ip[0], src_ip[1], src_ip[2], src_ip[3], id, seq, rtt / 1e6, stack_ns / 1e6);
+        } else {
+            printf("PING reply: %d.%d.%d.%d id=%u seq=%u rtt=%.3f ms\n",
+                   src_ip[0], src_ip[1], src_ip[2], src_ip[3], id, seq, rtt / 1e6);
         }
+#endif
+#if XNET_CFG_TRACEROUTE
     } else if (icmp->type == 11) {  // Time Exceeded
         // This is sent by a router when TTL reaches 0
         if (traceroute_active) {
-            // Extract timestamp from the encapsulated packet if present
-            uint32_t rtt_ticks = 0;
-            if (packet->size >= sizeof(xicmp_hdr_t) + sizeof(xip_hdr_t) + sizeof(xicmp_hdr_t) + 4) {
-                uint8_t *encap_data = packet->data
-                                     + sizeof(xicmp_hdr_t)
-                                     + sizeof(xip_hdr_t)
-                                     + sizeof(xicmp_hdr_t);
-                rtt_ticks = (uint32_t)encap_data[0]
-                          | ((uint32_t)encap_data[1] << 8)
-                          | ((uint32_t)encap_data[2] << 16)
-                          | ((uint32_t)encap_data[3] << 24);
-                uint32_t now = xnet_now_ms();             // 时间戳
-                uint32_t diff = (now >= rtt_ticks) ? (now - rtt_ticks) : 0;
-                printf("  Hop from: %d.%d.%d.%d (rtt=%u ms)\n",
-                       src_ip[0], src_ip[1], src_ip[2], src_ip[3], diff);
+            // 差错报文中带有原探测包的 ICMP 头，按其 id/seq 找回发送时间
+            int64_t rtt = -1;
+            int64_t stack_ns;
+            if (size >= sizeof(xicmp_hdr_t) + sizeof(xip_hdr_t) + sizeof(xicmp_hdr_t)) {
+                xicmp_hdr_t *encap = (xicmp_hdr_t *)((uint8_t *)(icmp + 1) + sizeof(xip_hdr_t));
+                rtt = xicmp_probe_rtt(encap->id, encap->seq, packet->rx_ts_ns, &stack_ns);
+            }
+            if (rtt >= 0) {
+                printf("  Hop from: %d.%d.%d.%d (rtt=%.3f ms)\n",
+                       src_ip[0], src_ip[1], src_ip[2], src_ip[3], rtt / 1e6);
             } else {
                 printf("  Hop from: %d.%d.%d.%d\n",
                        src_ip[0], src_ip[1], src_ip[2], src_ip[3]);
@@ -602,30 +1161,30 @@ static void xicmp_in(const uint8_t src_ip[4], xnet_packet_t *packet) {
                    src_ip[0], src_ip[1], src_ip[2], src_ip[3], icmp->code);
             traceroute_reached_dest = 1;  // Consider this as end
         }
+#endif
     }
 }
 
+#if XNET_CFG_PING
 // Send one ICMP Echo Request to dest_ip. Returns 0 if packet sent, -1 if ARP unresolved
 int xicmp_ping(const uint8_t dest_ip[4], uint16_t id, uint16_t seq, uint16_t data_size) {
-    // Check ARP cache first
-    const uint8_t *mac = arp_resolve(dest_ip);
-    if (!mac) {
-        // ARP in progress; arp_resolve has initiated request if needed
-        return -1;
-    }
-
-    // Ensure payload has room for timestamp and stays within buffer limits
+    // Ensure payload has room for timestamp and fits in one MTU (no fragmentation)
     uint16_t payload_len = (data_size < 4) ? 4 : data_size;
-    const uint16_t max_payload = XNET_CFG_PACKET_MAX_SIZE
-                                 - (uint16_t)sizeof(xether_hdr_t)
+    const uint16_t max_payload = netif_mtu
                                  - (uint16_t)sizeof(xip_hdr_t)
                                  - (uint16_t)sizeof(xicmp_hdr_t);
     if (payload_len > max_payload) {
         payload_len = max_payload;
     }
 
+    // 从这里开始计入协议栈的发送开销
+    xicmp_probe_record(id, seq);
+
     // Build ICMP Echo Request with timestamp payload
     xnet_packet_t *packet = xnet_alloc_for_send((uint16_t)(sizeof(xicmp_hdr_t) + payload_len));
+    if (!packet) {
+        return -1;
+    }
     xicmp_hdr_t *icmp = (xicmp_hdr_t *)packet->data;
 
     icmp->type = 8; // Echo Request
@@ -649,28 +1208,37 @@ int xicmp_ping(const uint8_t dest_ip[4], uint16_t id, uint16_t seq, uint16_t dat
     icmp->checksum = icmp_checksum16(icmp, packet->size);
 
     // send via IP layer
-    xip_out(XIP_PROTOCOL_ICMP, dest_ip, packet);
-    return 0;
+    packet->flags |= XNET_PACKET_TX_TIMESTAMP;
+    xnet_err_t err = xip_out(XIP_PROTOCOL_ICMP, dest_ip, packet);
+    xnet_free(packet);
+    return (err == XNET_ERR_IO) ? -1 : 0;
 }
+#endif
 
-void xip_out_ttl(xip_protocol_t protocol,
+xnet_err_t xip_out_ttl(xip_protocol_t protocol,
                  const uint8_t dest_ip[4],
                  xnet_packet_t *packet,
                  uint8_t ttl) {
-    // 先查 ARP：拿到对方 MAC（目前我们已经有 arp_resolve）
-    const uint8_t *mac = arp_resolve(dest_ip);
-    if (!mac) {
-        // 还没解析到 MAC，先等 ARP 表更新
-        return;
+    // 不分片，超过 MTU 的包不发送
+    if (xnet_chain_size(packet) + sizeof(xip_hdr_t) > netif_mtu) {
+        xnet_stats.tx_dropped++;
+        return XNET_ERR_IO;
     }
 
-    // 在 ICMP 前面加 IP 头
-    add_header(packet, sizeof(xip_hdr_t));
-    xip_hdr_t *ip = (xip_hdr_t *)packet->data;
+    // 在 ICMP 前面加 IP 头，缓冲区被共享时 IP 头写在私有的缓冲区中
+    if (xnet_unshare_header(packet, 0) != XNET_ERR_OK) {
+        xnet_stats.tx_dropped++;
+        return XNET_ERR_IO;
+    }
+    xip_hdr_t *ip = (xip_hdr_t *)xnet_push(packet, sizeof(xip_hdr_t));
+    if (!ip) {
+        xnet_stats.tx_dropped++;
+        return XNET_ERR_IO;
+    }
 
     ip->ver_hdrlen     = 0x45;
     ip->tos            = 0;
-    ip->total_len      = swap_order16(packet->size);
+    ip->total_len      = swap_order16((uint16_t)xnet_chain_size(packet));
     ip->id             = 0;
     ip->flags_fragment = 0;
     ip->ttl            = ttl;  // Use custom TTL
@@ -680,26 +1248,55 @@ void xip_out_ttl(xip_protocol_t protocol,
     ip->hdr_checksum   = 0;
     ip->hdr_checksum   = ip_checksum16(ip, sizeof(xip_hdr_t));
 
+    // 查 ARP：还没解析到 MAC 时暂存到表项中，等 ARP 应答到达后发出
+    const uint8_t *mac = arp_resolve(dest_ip);
+    if (!mac) {
+        xarp_entry_t *e = arp_table_find(dest_ip);
+        if (!e || e->state != XARP_ENTRY_PENDING) {
+            xnet_stats.arp_queue_dropped++;
+            return XNET_ERR_IO;
+        }
+        return (arp_hold_packet(e, packet) == XNET_ERR_OK) ? XNET_ERR_PENDING : XNET_ERR_IO;
+    }
+
     // 交给以太网层发送
-    ethernet_out_to(XNET_PROTOCOL_IP, mac, packet);
+    return ethernet_out_to(XNET_PROTOCOL_IP, mac, packet);
 }
 
-void xip_out(xip_protocol_t protocol,
+xnet_err_t xip_out(xip_protocol_t protocol,
              const uint8_t dest_ip[4],
              xnet_packet_t *packet) {
-    xip_out_ttl(protocol, dest_ip, packet, 64);  // Default TTL=64
+    return xip_out_ttl(protocol, dest_ip, packet, 64);  // Default TTL=64
 }
 
+/**
+ * 16 位反码和校验
+ * 起始地址按 4 字节对齐时（接收的帧中 IP 头之后的各层都是如此）每次累加 32 位，
+ * 反码和与累加的字宽无关，最后折叠成 16 位即可；其余情况逐个 16 位读取，不做非对齐的指针解引用
+ */
 static uint16_t checksum16(const void *buf, uint16_t len) {
-    const uint16_t *data = buf;
-    uint32_t sum = 0;
+    const uint8_t *data = buf;
+    uint64_t sum = 0;
+
+    if (XNET_IS_ALIGNED(data, 4)) {
+        const uint8_t *word = XNET_ASSUME_ALIGNED(data, 4);
+
+        while (len >= 4) {
+            sum += xnet_read32(word);
+            word += 4;
+            len -= 4;
+        }
+        data = word;
+    }
 
     while (len > 1) {
-        sum += *data++;
+        sum += xnet_read16(data);
+        data += 2;
         len -= 2;
     }
     if (len) {
-        sum += *(const uint8_t *)data;
+        uint8_t last[2] = {*data, 0};           // 奇数长度时末尾补 0
+        sum += xnet_read16(last);
     }
 
     while (sum >> 16) {
@@ -711,7 +1308,7 @@ static uint16_t checksum16(const void *buf, uint16_t len) {
 static uint16_t ip_checksum16(const void *buf, uint16_t len)   { return checksum16(buf, len); }
 static uint16_t icmp_checksum16(const void *buf, uint16_t len) { return checksum16(buf, len); }
 
-#if XNET_VROUTER_ENABLE
+#if XNET_CFG_VROUTER
 static void vrouter_send_time_exceeded(uint8_t hop_index,
                                        uint8_t original_ttl,
                                        const uint8_t dest_ip[4],
@@ -748,6 +1345,7 @@ static void vrouter_send_time_exceeded(uint8_t hop_index,
 
     // Build ICMP payload as before
     xnet_packet_t *resp = xnet_alloc_for_send((uint16_t)(sizeof(xicmp_hdr_t) + sizeof(orig_ip) + inner_icmp_len));
+    if (!resp) return;
     xicmp_hdr_t *icmp = (xicmp_hdr_t *)resp->data;
     icmp->type = XICMP_TYPE_TIME_EXCEEDED;
     icmp->code = 0;
@@ -761,8 +1359,11 @@ static void vrouter_send_time_exceeded(uint8_t hop_index,
     icmp->checksum = icmp_checksum16(icmp, resp->size);
 
     // Wrap with IP header so it goes out to the NIC
-    add_header(resp, sizeof(xip_hdr_t));
-    xip_hdr_t *ip = (xip_hdr_t *)resp->data;
+    xip_hdr_t *ip = (xip_hdr_t *)xnet_push(resp, sizeof(xip_hdr_t));
+    if (!ip) {
+        xnet_free(resp);
+        return;
+    }
     ip->ver_hdrlen     = 0x45;
     ip->tos            = 0;
     ip->total_len      = swap_order16(resp->size);
@@ -779,7 +1380,13 @@ static void vrouter_send_time_exceeded(uint8_t hop_index,
     ethernet_out_to(XNET_PROTOCOL_IP, netif_mac, resp);
 
     // Optional: still inject locally to keep current traceroute state machine instant
-    xicmp_in(virtual_hops[hop_index], resp);
+    // 发送后 data 指向以太网头，与收到的帧一样解析后交给 ICMP 层
+    resp->rx_ts_ns = xnet_time_ns();
+    resp->flags = XNET_PACKET_CSUM_LOCAL;           // 校验和刚刚算好，不必再验证
+    if (packet_parse(resp) == XNET_ERR_OK) {
+        xicmp_in(resp);
+    }
+    xnet_free(resp);
 }
 
 static int vrouter_handle_traceroute(uint8_t ttl,
@@ -811,14 +1418,21 @@ static int vrouter_handle_traceroute(uint8_t ttl,
 }
 #endif
 
+#if XNET_CFG_TRACEROUTE
 // Traceroute implementation
 int xicmp_traceroute_probe(const uint8_t dest_ip[4], uint16_t id, uint16_t seq, uint8_t ttl) {
     // Kick ARP early so resolution starts even while virtual hops respond
-    const uint8_t *mac_bootstrap = arp_resolve(dest_ip);
+    arp_resolve(dest_ip);
+
+    // 从这里开始计入协议栈的发送开销
+    xicmp_probe_record(id, seq);
 
     // Build ICMP Echo Request with timestamp payload
     const uint16_t payload_len = 4;
     xnet_packet_t *packet = xnet_alloc_for_send((uint16_t)(sizeof(xicmp_hdr_t) + payload_len));
+    if (!packet) {
+        return -1;
+    }
     xicmp_hdr_t *icmp = (xicmp_hdr_t *)packet->data;
 
     icmp->type = 8;  // Echo Request
@@ -839,22 +1453,19 @@ int xicmp_traceroute_probe(const uint8_t dest_ip[4], uint16_t id, uint16_t seq,
 
     uint8_t send_ttl = ttl;
 
-#if XNET_VROUTER_ENABLE
+#if XNET_CFG_VROUTER
     // Optionally simulate intermediate hops to widen traceroute output
     if (traceroute_active && vrouter_handle_traceroute(ttl, dest_ip, packet, &send_ttl)) {
+        xnet_free(packet);
         return 0;
     }
 #endif
 
-    // Check ARP cache before actually sending to the network
-    const uint8_t *mac = mac_bootstrap ? mac_bootstrap : arp_resolve(dest_ip);
-    if (!mac) {
-        return -1;  // ARP in progress
-    }
-
-    // Send with adjusted TTL if virtual hops are configured
-    xip_out_ttl(XIP_PROTOCOL_ICMP, dest_ip, packet, send_ttl);
-    return 0;
+    // Send with adjusted TTL if virtual hops are configured; held in the ARP entry until the MAC is known
+    packet->flags |= XNET_PACKET_TX_TIMESTAMP;
+    xnet_err_t err = xip_out_ttl(XIP_PROTOCOL_ICMP, dest_ip, packet, send_ttl);
+    xnet_free(packet);
+    return (err == XNET_ERR_IO) ? -1 : 0;
 }
 
 int xicmp_traceroute_is_complete(void) {
@@ -876,3 +1487,4 @@ void xicmp_traceroute_reset(void) {
     traceroute_active      = 1;
     traceroute_hop_replied = 0;
 }
+#endif
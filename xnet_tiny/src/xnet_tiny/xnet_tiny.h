@@ -2,9 +2,29 @@
 #define XNET_TINY_H
 
 #include <stdint.h>
+#include <string.h>
+#include "net_irq.h"
+#include "net_filter.h"
+#include "net_mtu.h"
+#include "xnet_cfg.h"
 
-// 收发数据包的最大大小
-#define XNET_CFG_PACKET_MAX_SIZE        1516
+// 帧长比 MTU 多出的部分：14 字节以太网头与 2 字节余量
+#define XNET_ETHER_OVERHEAD             16
+
+// 收发数据包的最大大小，由编译时的 MTU 上限 XNET_CFG_MTU（net_mtu.h）决定，默认 1516
+#define XNET_CFG_PACKET_MAX_SIZE        (XNET_CFG_MTU + XNET_ETHER_OVERHEAD)
+
+// 以太网头前的填充：14 字节的以太网头之后，IP 头正好落在 4 字节边界上
+#define XNET_PACKET_PAD                 2
+
+// 数据包缓冲区大小：填充 + 最大帧长
+#define XNET_PACKET_BUF_SIZE            (XNET_PACKET_PAD + XNET_CFG_PACKET_MAX_SIZE)
+
+// 发送数据包默认在数据前面留出的空间，放得下填充、以太网头与 IP 头，各层加头部时不必移动数据
+#define XNET_CFG_PACKET_HEADROOM        (XNET_PACKET_PAD + 14 + 20)
+
+// 定时器 tick 周期（毫秒），ARP 表的超时以 tick 计数
+#define XNET_TICK_MS                    100
 
 #pragma pack(1)
 
@@ -60,7 +80,23 @@ typedef struct _xarp_packet_t {
     uint8_t  target_ip[4];                         // 目标 IP
 } xarp_packet_t;
 
-#define XARP_TABLE_SIZE 8
+typedef enum _xarp_opcode_t {
+    XARP_OPCODE_REQUEST = 1,                       // ARP 请求
+    XARP_OPCODE_REPLY   = 2,                       // ARP 应答
+} xarp_opcode_t;
+
+/**
+ * 以太网帧头格式，参考 RFC894
+ */
+typedef struct _xether_hdr_t {
+    uint8_t dest[XNET_MAC_ADDR_SIZE];              // 目的 MAC 地址
+    uint8_t src[XNET_MAC_ADDR_SIZE];               // 源 MAC 地址
+    uint16_t protocol;                             // 上层协议类型
+} xether_hdr_t;
+
+#pragma pack()
+
+#define XARP_TABLE_SIZE XNET_CFG_ARP_TABLE_SIZE
 
 typedef enum _xarp_entry_state_t {
     XARP_ENTRY_FREE = 0,
@@ -74,44 +110,215 @@ typedef struct _xarp_entry_t {
     xarp_entry_state_t state;
     uint8_t retry;      // 已重发次数
     uint16_t ttl;       // 剩余“生存时间”（轮询计数）
+    struct _xnet_packet_t * hold;   // 等待 MAC 的 IP 包，用 next 串成先进先出队列
+    uint8_t hold_count;             // 队列中的包数
 } xarp_entry_t;
 
-typedef enum _xarp_opcode_t {
-    XARP_OPCODE_REQUEST = 1,                       // ARP 请求
-    XARP_OPCODE_REPLY   = 2,                       // ARP 应答
-} xarp_opcode_t;
+#if defined(_MSC_VER)
+#define XNET_ALIGNED(n)                 __declspec(align(n))
+#else
+#define XNET_ALIGNED(n)                 __attribute__((aligned(n)))
+#endif
+
+// 指针是否按 n（2 的幂）字节对齐
+#define XNET_IS_ALIGNED(p, n)           ((((uintptr_t)(p)) & ((n) - 1)) == 0)
+
+// 告诉编译器指针已按 n 字节对齐，经 xnet_read32 等读写时可生成整字访问
+#if defined(__GNUC__)
+#define XNET_ASSUME_ALIGNED(p, n)       ((const uint8_t *)__builtin_assume_aligned((p), (n)))
+#else
+#define XNET_ASSUME_ALIGNED(p, n)       ((const uint8_t *)(p))
+#endif
 
 /**
- * 以太网帧头格式，参考 RFC894
+ * 包头字段的读写：地址不保证对齐时用 memcpy，编译器在允许非对齐访问的 CPU 上生成单条读写指令，
+ * 在要求严格对齐的 CPU 上按字节访问，避免直接解引用 uint16_t/uint32_t 指针带来的未定义行为
  */
-typedef struct _xether_hdr_t {
-    uint8_t dest[XNET_MAC_ADDR_SIZE];              // 目的 MAC 地址
-    uint8_t src[XNET_MAC_ADDR_SIZE];               // 源 MAC 地址
-    uint16_t protocol;                             // 上层协议类型
-} xether_hdr_t;
-
-#pragma pack()
+static inline uint16_t xnet_read16(const void * p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t xnet_read32(const void * p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void xnet_write16(void * p, uint16_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void xnet_write32(void * p, uint32_t v) {
+    memcpy(p, &v, sizeof(v));
+}
 
 typedef enum _xnet_err_t {
     XNET_ERR_OK = 0,
     XNET_ERR_IO = -1,
+    XNET_ERR_PENDING = 1,                          // 没有出错，但尚未完成：如 IP 包暂存在 ARP 表项中等待 MAC
 } xnet_err_t;
 
+/**
+ * 接收的帧进入协议栈时解析一次得到的包头信息，各层直接使用，不再各自计算长度与偏移、移动 data。
+ * 偏移都相对 data，以太网头在 0 处
+ */
+typedef struct _xnet_meta_t {
+    uint16_t l2_protocol;                          // 以太网类型，主机字节序
+    uint16_t l3_offset;                            // 网络层（ARP/IP）头的偏移
+    uint16_t l4_offset;                            // IP 上层协议头的偏移，非 IPv4 时为 0
+    uint16_t l4_size;                              // IP 上层数据长度，按 IP 总长度计算，不含以太网的填充
+    uint8_t l4_protocol;                           // IP 上层协议
+    uint8_t flags;                                 // XNET_META_*
+    uint8_t src_ip[XNET_IP_ADDR_SIZE];             // 源 IP，XNET_META_IPV4 时有效
+    uint8_t dest_ip[XNET_IP_ADDR_SIZE];            // 目的 IP，XNET_META_IPV4 时有效
+} xnet_meta_t;
+
+// 包头信息标志
+#define XNET_META_IPV4                  (1 << 0)   // IPv4 头结构完整，IP 与 l4 字段可用
+#define XNET_META_BROADCAST             (1 << 1)   // 目的 MAC 为广播地址
+#define XNET_META_TO_US                 (1 << 2)   // 目的 IP 为本机
+
 /**
  * 网络数据包结构
  */
 typedef struct _xnet_packet_t{
     uint16_t size;                                 // 当前有效数据长度
-    uint8_t * data;                                // 当前数据起始地址
-    uint8_t payload[XNET_CFG_PACKET_MAX_SIZE];     // 最大负载空间
+    uint8_t * data;                                // 当前数据起始地址，接收时可能指向驱动的缓冲区（只读）
+    uint64_t rx_ts_ns;                             // 接收时间戳（ns，墙上时间），由驱动或协议栈在收到时填写
+    uint8_t flags;                                 // XNET_PACKET_*
+    struct _xnet_packet_t * next;                  // 池的空闲链表或队列中的下一个
+    struct _xnet_packet_t * chain;                 // 同一个数据包的下一段，为 0 时数据全在本段中
+    struct _xnet_packet_t * owner;                 // 克隆的数据包：data 所在缓冲区的数据包，为 0 时用自己的 payload
+    volatile uint32_t ref;                         // payload 的引用数，包括自己与引用它的克隆，为 0 时还回池
+    xnet_meta_t meta;                              // 接收时解析得到的包头信息
+    XNET_ALIGNED(XNET_CFG_CACHE_LINE)
+    uint8_t payload[XNET_PACKET_BUF_SIZE];         // 最大负载空间，按缓存行对齐，帧从 XNET_PACKET_PAD 处开始
 } xnet_packet_t;
 
+// 驱动把收到的帧读入数据包时的起始地址，使 IP 头按 4 字节对齐
+#define xnet_packet_frame(packet)       ((packet)->payload + XNET_PACKET_PAD)
+
+// 数据包标志
+#define XNET_PACKET_TX_TIMESTAMP        (1 << 0)   // 发送时请求驱动回报发送完成时间戳，并立即交给网卡
+#define XNET_PACKET_CSUM_VALID          (1 << 1)   // 接收：网卡或内核已验证过上层的校验和，IP 头仍需验证
+#define XNET_PACKET_CSUM_PARTIAL        (1 << 2)   // 接收：本机发出的帧，校验和留给网卡计算，尚未填好，不能验证
+#define XNET_PACKET_CSUM_LOCAL          (1 << 3)   // 接收：帧未经过线路（进程内传递或协议栈自己生成），各层都不必验证
+
+/**
+ * 数据包池统计
+ */
+typedef struct _xnet_pool_stats_t {
+    uint32_t size;                                 // 池中数据包总数
+    uint32_t in_use;                               // 已分配、尚未释放的数量
+    uint32_t high_water;                           // in_use 的最大值
+    uint32_t alloc_fail;                           // 池已用完导致分配失败的次数
+} xnet_pool_stats_t;
+
+// 分配的数据包由调用者用 xnet_free 释放，交给 xip_out、xnet_driver_send 等发送后仍归调用者所有
 xnet_packet_t * xnet_alloc_for_send(uint16_t data_size);
 xnet_packet_t * xnet_alloc_for_read(uint16_t data_size);
+void xnet_free(xnet_packet_t * packet);
+
+/**
+ * 共享：xnet_clone 得到的数据包有自己的 data/size/flags，但与原包共用同一块缓冲区，
+ * 各自用 xnet_free 释放，最后一个释放时缓冲区才还回池。
+ * 缓冲区被共享时没有头部与尾部空间，要修改包头先用 xnet_unshare_header 取得私有的副本
+ */
+xnet_packet_t * xnet_clone(xnet_packet_t * packet);
+int xnet_shared(const xnet_packet_t * packet);
+xnet_err_t xnet_unshare_header(xnet_packet_t * packet, uint16_t size);
+void xnet_pool_flush(void);
+const xnet_pool_stats_t * xnet_pool_get_stats(void);
+
+/**
+ * 缓冲区操作：data 之前到 payload 开头为头部空间（headroom），data + size 之后到 payload 末尾为尾部空间（tailroom）。
+ * 头部空间包括 XNET_PACKET_PAD，加满以太网头后 data 停在 payload + XNET_PACKET_PAD。
+ * 数据指向驱动缓冲区的接收包没有头部与尾部空间，只能 pull/trim
+ */
+uint16_t xnet_headroom(const xnet_packet_t * packet);
+uint16_t xnet_tailroom(const xnet_packet_t * packet);
+void xnet_reserve(xnet_packet_t * packet, uint16_t size);
+uint8_t * xnet_push(xnet_packet_t * packet, uint16_t size);
+uint8_t * xnet_pull(xnet_packet_t * packet, uint16_t size);
+uint8_t * xnet_put(xnet_packet_t * packet, uint16_t size);
+void xnet_trim(xnet_packet_t * packet, uint16_t size);
+
+/**
+ * 分段：超过一个缓冲区的数据由多段用 chain 串起来，xnet_free 释放整条链。
+ * 交给驱动前由 xnet_linearize 拼成可写的一段
+ */
+void xnet_chain(xnet_packet_t * packet, xnet_packet_t * segment);
+uint32_t xnet_chain_size(const xnet_packet_t * packet);
+uint32_t xnet_chain_copy(const xnet_packet_t * packet, uint32_t offset, uint8_t * buf, uint32_t size);
+xnet_packet_t * xnet_linearize(xnet_packet_t * packet);
+
+// 驱动能力
+#define XNET_DRIVER_CAP_BATCH           (1 << 0)   // read_batch 一次可读出多帧
+#define XNET_DRIVER_CAP_ZERO_COPY       (1 << 1)   // 接收的帧直接指向驱动的缓冲区，处理完需归还
+#define XNET_DRIVER_CAP_WAIT            (1 << 2)   // 可阻塞等待数据包到来
+#define XNET_DRIVER_CAP_RX_TIMESTAMP    (1 << 3)   // 接收的帧带有驱动给出的时间戳
+#define XNET_DRIVER_CAP_TX_TIMESTAMP    (1 << 4)   // 可回报帧离开网卡驱动的时间戳
+#define XNET_DRIVER_CAP_IRQ             (1 << 5)   // 可在接收线程中收帧，以回调方式交给协议栈
+#define XNET_DRIVER_CAP_RX_CSUM         (1 << 6)   // 接收的帧带有校验和状态 XNET_PACKET_CSUM_*
+
+/**
+ * 驱动及内核的接收统计，自驱动打开以来累计
+ */
+typedef struct _xnet_driver_stats_t {
+    uint32_t recv;                                 // 驱动收到的帧数
+    uint32_t drop;                                 // 缓冲区满被内核丢弃的帧数
+    uint32_t ifdrop;                               // 被网卡或其驱动丢弃的帧数
+    uint32_t irq_drop;                             // 回调接收方式下接收队列满被丢弃的帧数
+    uint32_t filtered;                             // 被内核过滤器丢弃的帧数，驱动无法得知时为 0
+} xnet_driver_stats_t;
+
+/**
+ * 接收方式
+ */
+typedef enum _xnet_rx_mode_t {
+    XNET_RX_POLL,                                  // 协议栈在 xnet_poll() 中向驱动读取
+    XNET_RX_IRQ,                                   // 驱动线程收帧后放入无锁队列并唤醒协议栈，xnet_poll() 从队列中取
+} xnet_rx_mode_t;
+
+/**
+ * 网卡驱动接口，各驱动在 xnet_app/port_*.c 中实现，运行时按名称选择
+ * read_batch、flush、release、wait、tx_timestamp、stats、start_rx、set_filter 可为 0，由 xnet_driver_* 给出缺省行为
+ */
+typedef struct _xnet_driver_ops_t {
+    const char * name;                             // 驱动名称，如 "pcap"、"tpacket"
+    uint32_t caps;                                 // XNET_DRIVER_CAP_*
+    xnet_err_t (*open)(uint8_t * mac_addr);
+    xnet_err_t (*send)(xnet_packet_t * packet);
+    xnet_err_t (*read)(xnet_packet_t ** packet);
+    uint16_t (*read_batch)(xnet_packet_t * packets, uint16_t max);
+    xnet_err_t (*flush)(void);
+    void (*release)(xnet_packet_t * packets, uint16_t count);
+    xnet_err_t (*wait)(uint32_t timeout_ms);
+    xnet_err_t (*tx_timestamp)(const uint8_t ** frame, uint16_t * size, uint64_t * timestamp);
+    xnet_err_t (*stats)(xnet_driver_stats_t * stats);
+    xnet_err_t (*start_rx)(irq_handler_t handler, void * arg);
+    xnet_err_t (*set_filter)(const net_filter_t * filter);
+} xnet_driver_ops_t;
+
+xnet_err_t xnet_driver_select (const char * name);
+const xnet_driver_ops_t * xnet_driver_current (void);
+const xnet_driver_ops_t * xnet_driver_find (const char * name);
+const xnet_driver_ops_t * xnet_driver_get (int index);
+xnet_err_t xnet_driver_set_rx_mode (xnet_rx_mode_t mode);
+uint32_t xnet_driver_caps (void);
 
 xnet_err_t xnet_driver_open (uint8_t * mac_addr);
 xnet_err_t xnet_driver_send (xnet_packet_t * packet);
 xnet_err_t xnet_driver_read (xnet_packet_t ** packet);
+uint16_t xnet_driver_read_batch (xnet_packet_t * packets, uint16_t max);
+xnet_err_t xnet_driver_flush (void);
+void xnet_driver_release (xnet_packet_t * packets, uint16_t count);
+xnet_err_t xnet_driver_wait (uint32_t timeout_ms);
+xnet_err_t xnet_driver_tx_timestamp (const uint8_t ** frame, uint16_t * size, uint64_t * timestamp);
+xnet_err_t xnet_driver_stats (xnet_driver_stats_t * stats);
+xnet_err_t xnet_driver_set_filter (const net_filter_t * filter);
 
 typedef enum _xnet_protocol_t {
     XNET_PROTOCOL_ARP = 0x0806,                    // ARP 协议
@@ -121,28 +328,87 @@ typedef enum _xnet_protocol_t {
 const uint8_t * arp_resolve(const uint8_t ip[4]);
 void arp_table_timer(void);
 
+/**
+ * 协议栈收发统计
+ */
+typedef struct _xnet_stats_t {
+    uint32_t rx_packets;                           // 从驱动收到的帧数
+    uint32_t tx_packets;                           // 交给驱动发送的帧数
+    uint32_t tx_dropped;                           // 超过 MTU、头部空间不足或分段拼接失败而未能发送的帧数
+    uint32_t arp_queued;                           // 因 MAC 未知而暂存在 ARP 表项中的 IP 包数
+    uint32_t arp_queue_sent;                       // 解析完成后从暂存队列发出的 IP 包数
+    uint32_t arp_queue_dropped;                    // 队列已满、解析超时或无法暂存而丢弃的 IP 包数
+    uint64_t rx_bytes;                             // 收到的字节数
+    uint64_t tx_bytes;                             // 发送的字节数
+    uint32_t polls;                                // poll 次数
+    uint32_t empty_polls;                          // 没有收到任何帧的 poll 次数
+    uint32_t budget_exhausted;                     // 用完预算的 poll 次数
+    uint32_t rx_batches;                           // 批量读取的次数
+    uint32_t tx_flushes;                           // 发送队列提交的次数
+    uint32_t waits;                                // 阻塞等待驱动的次数
+    uint32_t tx_timestamps;                        // 驱动回报的发送时间戳数
+    uint32_t rx_filtered;                          // 驱动交上来、但不是发给本机或协议未启用而丢弃的帧数
+    uint32_t ip_csum_skipped;                      // 驱动已给出校验和状态，IP 层跳过验证的次数
+    uint32_t icmp_csum_skipped;                    // 同上，ICMP 层跳过验证的次数
+    uint16_t last_poll_packets;                    // 最近一次 poll 处理的帧数
+    uint16_t max_poll_packets;                     // 单次 poll 处理的最多帧数
+    xnet_driver_stats_t driver;                    // 驱动的接收统计，每 XNET_CFG_DRIVER_STATS_TICKS 个 tick 刷新
+} xnet_stats_t;
+
+/**
+ * xnet_poll() 在上一次没有收到帧时的等待方式
+ */
+typedef enum _xnet_wait_mode_t {
+    XNET_WAIT_NONE,                                // 不等待，由调用者决定何时再次 poll
+    XNET_WAIT_BLOCK,                               // 阻塞在驱动上，直到有帧、下一个 tick 到期或超过最长等待时间
+    XNET_WAIT_BUSY,                                // 忙轮询，连续空轮询时逐步退避，延迟最低
+} xnet_wait_mode_t;
+
 void xnet_init (void);
 void xnet_poll(void);
-
+void xnet_flush(void);
+const xnet_stats_t * xnet_get_stats(void);
+void xnet_set_poll_budget(uint16_t budget);
+void xnet_set_wait_mode(xnet_wait_mode_t mode, uint32_t max_wait_ms);
+xnet_err_t xnet_set_cpu(int cpu);
+void xnet_set_ip(const uint8_t ip[4]);
+xnet_err_t xnet_set_mtu(uint16_t mtu);
+uint16_t xnet_get_mtu(void);
+uint32_t xnet_now_ms(void);
+uint64_t xnet_time_ns(void);
+
+// packet 为完整的以太网帧，meta 已由接收路径填好
 void xip_in(xnet_packet_t *packet);
-void xip_out(xip_protocol_t protocol,
+// MAC 未知时 packet 的克隆放入 ARP 表项的暂存队列，与 packet 共用缓冲区，解析完成后自动发出；
+// packet 仍由调用者释放，调用后不能再修改其缓冲区中的数据
+// 返回 0 - 已交给驱动，XNET_ERR_PENDING - 暂存等待 ARP，XNET_ERR_IO - 丢弃
+xnet_err_t xip_out(xip_protocol_t protocol,
              const uint8_t dest_ip[4],
              xnet_packet_t *packet);
 
-void xip_out_ttl(xip_protocol_t protocol,
+xnet_err_t xip_out_ttl(xip_protocol_t protocol,
                  const uint8_t dest_ip[4],
                  xnet_packet_t *packet,
                  uint8_t ttl);
 
+#if XNET_CFG_PING
 // Send a single ICMP Echo Request (ping) with configurable payload size
-// Returns 0 on success (packet sent), -1 if destination MAC unknown (ARP in progress)
+// Returns 0 on success (packet sent, or held until ARP resolves the destination), -1 if it could not be sent or held
 int xicmp_ping(const uint8_t dest_ip[4], uint16_t id, uint16_t seq, uint16_t data_size);
 
 // Get RTT (ms) of the last received ICMP Echo Reply; returns -1 if none pending
 int xicmp_get_last_rtt(void);
 
+// 同上，单位为 ns：回复的接收时间戳减去请求离开驱动的时间，不含协议栈的发送开销
+int64_t xicmp_get_last_rtt_ns(void);
+
+// 最近一次回复对应请求的协议栈发送开销（ns）：从开始构造请求到离开驱动，没有时返回 -1
+int64_t xicmp_get_last_stack_ns(void);
+#endif
+
+#if XNET_CFG_TRACEROUTE
 // Traceroute: send ICMP Echo with specific TTL
-// Returns 0 on success, -1 if ARP unresolved
+// Returns 0 on success (packet sent, or held until ARP resolves the destination), -1 if it could not be sent or held
 int xicmp_traceroute_probe(const uint8_t dest_ip[4], uint16_t id, uint16_t seq, uint8_t ttl);
 
 // Check if traceroute has reached destination
@@ -154,6 +420,7 @@ int xicmp_traceroute_has_hop_reply(void);
 
 // Get traceroute hop information
 void xicmp_traceroute_reset(void);
+#endif
 
              
 #endif // XNET_TINY_H